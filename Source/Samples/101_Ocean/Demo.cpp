@@ -21,6 +21,7 @@
 //
 
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/ProcessUtils.h>
 #include <Urho3D/Core/Profiler.h>
 #include <Urho3D/Engine/Engine.h>
 #include <Urho3D/Graphics/Camera.h>
@@ -44,6 +45,8 @@
 
 #include "Demo.h"
 #include "Ocean.h"
+#include "OceanSoak.h"
+#include "OceanTests.h"
 
 URHO3D_DEFINE_APPLICATION_MAIN(Demo)
 
@@ -52,11 +55,32 @@ Demo::Demo(Context* context) :
 {
 }
 
+void Demo::Setup()
+{
+    Sample::Setup();
+
+    soak_ = GetArguments().Contains("-soak");
+    test_ = GetArguments().Contains("-test");
+    if (soak_ || test_)
+        engineParameters_["Headless"] = true;
+}
+
 void Demo::Start()
 {
     // Register the Ocean Component
     Ocean::RegisterObject(context_);
 
+    if (soak_)
+    {
+        RunSoak();
+        return;
+    }
+    if (test_)
+    {
+        RunTests();
+        return;
+    }
+
     // Execute base class startup
     Sample::Start();
 
@@ -73,6 +97,26 @@ void Demo::Start()
     Sample::InitMouseMode(MM_RELATIVE);
 }
 
+void Demo::RunSoak()
+{
+    SharedPtr<OceanSoak> soak(new OceanSoak(context_));
+    const OceanSoak::Result result = soak->Run();
+    if (result.passed_)
+        engine_->Exit();
+    else
+        ErrorExit(OceanSoak::GetReport(result));
+}
+
+void Demo::RunTests()
+{
+    SharedPtr<OceanTests> tests(new OceanTests(context_));
+    const OceanTests::Result result = tests->Run();
+    if (result.passed_)
+        engine_->Exit();
+    else
+        ErrorExit(OceanTests::GetReport(result));
+}
+
 void Demo::CreateScene()
 {
     scene_ = new Scene(context_);
@@ -132,6 +176,28 @@ void Demo::CreateOcean()
     oceanNode->SetPosition(Vector3(0.0f, 0.0f, 0.0f));
     Ocean* ocean = oceanNode->CreateComponent<Ocean>();
     ocean->SetModel(waterPlaneModel);
+    ocean->SetSharedSurface(true);
+
+    // Snap the waves to the size of the water plane, so that repeated tiles join without seams
+    const Vector3 tileSize = waterPlaneModel->GetBoundingBox().Size();
+    ocean->GetWaveManager()->SetTileSize(Vector2(tileSize.x_, tileSize.z_));
+
+    // Surround the ocean with tiles that render the surface computed by it
+    for (int z = -1; z <= 1; ++z)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            if (x == 0 && z == 0)
+                continue;
+
+            Node* tileNode = scene_->CreateChild("OceanTile");
+            tileNode->SetPosition(Vector3(x * tileSize.x_, 0.0f, z * tileSize.z_));
+            Ocean* tile = tileNode->CreateComponent<Ocean>();
+            tile->SetWaveManager(ocean->GetWaveManager());
+            tile->SetModel(waterPlaneModel);
+            tile->SetSharedSurface(true);
+        }
+    }
 
     // Create the WaveEditor
     waveEditor_ = new WaveEditor(context_, ocean->GetWaveManager());
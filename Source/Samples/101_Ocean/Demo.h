@@ -39,6 +39,8 @@ public:
     /// Construct.
     Demo(Context* context);
 
+    /// Setup before engine initialization. With -soak or -test on the command line the engine runs headless.
+    virtual void Setup();
     /// Setup after engine initialization and before running the main loop.
     virtual void Start();
 
@@ -70,6 +72,10 @@ private:
     void CreateInstructions();
     /// Create Camera
     void CreateCamera();
+    /// Run the OceanSoak and exit, with an error if it failed
+    void RunSoak();
+    /// Run the OceanTests and exit, with an error if one failed
+    void RunTests();
 
     /// Set up a viewport for displaying the scene.
     void SetupViewport();
@@ -83,4 +89,8 @@ private:
     Camera* camera_;
     SharedPtr<WaveEditor> waveEditor_;
     bool editMode_ = false;
+    /// True if started with -soak
+    bool soak_ = false;
+    /// True if started with -test
+    bool test_ = false;
 };
@@ -21,17 +21,25 @@
 //
 
 #include "../Precompiled.h"
+#include "Urho3D/Container/Sort.h"
 #include "Urho3D/Core/Context.h"
-#include "Urho3D/Core/CoreEvents.h"
+#include "Urho3D/Core/Timer.h"
+#include "Urho3D/Core/WorkQueue.h"
+#include "Urho3D/Graphics/Camera.h"
 #include "Urho3D/Graphics/Geometry.h"
 #include "Urho3D/Graphics/Model.h"
+#include "Urho3D/Graphics/Terrain.h"
 #include "Urho3D/Graphics/VertexBuffer.h"
 #include "Urho3D/IO/Log.h"
+#include "Urho3D/Resource/Image.h"
 #include "Urho3D/Resource/ResourceEvents.h"
+#include "Urho3D/Scene/Scene.h"
 #include "Urho3D/Core/Profiler.h"
 
 #include "Ocean.h"
 #include "OceanAlgorithms.h"
+#include "OceanManager.h"
+#include "OceanMeshCache.h"
 
 
 namespace Urho3D
@@ -39,95 +47,1278 @@ namespace Urho3D
 
 extern const char* GEOMETRY_CATEGORY;
 
+/// Iterations of the search for the rest position below the samples of the surface cache, the interpolation between the
+/// samples is coarser than what further iterations would add
+static const unsigned OCEAN_SURFACE_CACHE_ITERATIONS = 2;
+
+/// Mesh data of a model that is prepared by a worker thread
+struct OceanMeshJob : public RefCounted
+{
+    SharedPtr<Model> model_;
+    SharedPtr<VertexBuffer> vertexBuffer_;
+    /// Input, copied on the main thread
+    PODVector<Vector3> positions_;
+    /// Output of the worker thread
+    OceanMeshData meshData_;
+    SharedPtr<WorkItem> workItem_;
+    /// Set when a later SetModel made the result obsolete
+    bool discarded_ = false;
+};
+
+static void PrepareMeshWork(const WorkItem* item, unsigned threadIndex)
+{
+    OceanMeshJob* job = reinterpret_cast<OceanMeshJob*>(item->aux_);
+    job->meshData_ = PrepareOceanMeshData(job->model_, job->positions_);
+}
+
+static void CopyToAlignedArray(const PODVector<float>& values, AlignedFloatArray& result)
+{
+    result.Resize(values.Size());
+    for (unsigned i = 0; i < values.Size(); ++i)
+        result[i] = values[i];
+}
+
+/// Orders waves by decreasing current amplitude
+static bool CompareWaveAmplitudes(const WaveSystem::Wave& lhs, const WaveSystem::Wave& rhs)
+{
+    return lhs.a_ != rhs.a_ ? lhs.a_ > rhs.a_ : lhs.id_ < rhs.id_;
+}
+
 Ocean::Ocean(Context* context) : StaticModel(context)
 {
     waveSystem_ = new WaveSystem(context);
+    governor_ = new OceanGovernor(context);
 
-    // Subscribe HandleUpdate() function for processing update events
-    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(Ocean, HandleUpdate));
+    SubscribeToEvent(E_WORKITEMCOMPLETED, URHO3D_HANDLER(Ocean, HandleWorkItemCompleted));
 }
 
 Ocean::~Ocean()
 {
+    if (oceanManager_)
+        oceanManager_->RemoveOcean(this);
+
+    // The worker threads write into the jobs. Jobs that have not started are removed from the queue, only the ones
+    // already running are waited for, not the other work items of their priority
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    for (auto& job : meshJobs_)
+    {
+        if (!queue || queue->RemoveWorkItem(job->workItem_))
+            continue;
+        while (!job->workItem_->completed_)
+            Time::Sleep(0);
+    }
 }
 
 void Ocean::RegisterObject(Context* context)
 {
     context->RegisterFactory<Ocean>(GEOMETRY_CATEGORY);
 
+    // Every scene with oceans gets an OceanManager that updates them
+    OceanManager::RegisterObject(context);
+
     URHO3D_COPY_BASE_ATTRIBUTES(StaticModel);
 }
 
 void Ocean::SetModel(Model* model)
 {
-    // Set the model for the base class StaticModel
-    StaticModel::SetModel(model);
+    if (serverMode_)
+    {
+        serverModeModel_ = model;
+        return;
+    }
+
+    Geometry* geom = model ? model->GetGeometry(0, 0) : nullptr;
+    VertexBuffer* vertexBuffer = geom ? geom->GetVertexBuffer(0) : nullptr;
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    if (!vertexBuffer || !queue)
+    {
+        // Nothing to prepare, drop pending jobs and switch immediately
+        OceanMeshJob job;
+        job.model_ = model;
+        job.vertexBuffer_ = vertexBuffer;
+        if (vertexBuffer)
+        {
+            job.positions_ = ExtractVertexPositions(vertexBuffer);
+            job.meshData_ = PrepareOceanMeshData(model, job.positions_);
+        }
+        for (auto& pendingJob : meshJobs_)
+            pendingJob->discarded_ = true;
+        ApplyMeshJob(job);
+        return;
+    }
+
+    // Show the new model flat while there is no previous one to animate
+    if (!model_)
+        StaticModel::SetModel(model);
+
+    // Copying the positions from the shadow data is cheap, the cache lookup and the duplicate search run in the background
+    SharedPtr<OceanMeshJob> job(new OceanMeshJob());
+    job->model_ = model;
+    job->vertexBuffer_ = vertexBuffer;
+    job->positions_ = ExtractVertexPositions(vertexBuffer);
+
+    job->workItem_ = queue->GetFreeItem();
+    job->workItem_->workFunction_ = PrepareMeshWork;
+    job->workItem_->aux_ = job.Get();
+    job->workItem_->priority_ = 0;
+    job->workItem_->sendEvent_ = true;
+    for (auto& pendingJob : meshJobs_)
+        pendingJob->discarded_ = true;
+    meshJobs_.Push(job);
+    queue->AddWorkItem(job->workItem_);
+}
+
+void Ocean::SetServerMode(const bool enable)
+{
+    if (enable == serverMode_)
+        return;
+
+    serverMode_ = enable;
+    if (!serverMode_)
+    {
+        // The mesh data, the animated vertices and the keyframes are prepared again from the model
+        SharedPtr<Model> model = serverModeModel_;
+        serverModeModel_.Reset();
+        SetModel(model);
+        return;
+    }
+
+    // Release the mesh and everything that was derived from it, the queries need none of it. Only the model that was
+    // set last is kept, a pending one replaces the current one
+    serverModeModel_ = model_;
+    for (auto& pendingJob : meshJobs_)
+    {
+        if (!pendingJob->discarded_)
+            serverModeModel_ = pendingJob->model_;
+        pendingJob->discarded_ = true;
+    }
+    OceanMeshJob job;
+    ApplyMeshJob(job);
+
+    restVertices_.shoreFactors_.Clear();
+    restVertices_.shoreFactors_.Compact();
+    depthChangedTiles_.Clear();
+    depthChangedTiles_.Compact();
+    animatedVertices_.Release();
+    changedTiles_.Clear();
+    changedTiles_.Compact();
+    for (auto& keyframe : keyframes_)
+        keyframe.vertices_.Release();
+    keyframeInterval_ = 0;
+}
+
+float Ocean::GetSurfaceHeight(const Vector3& worldPosition, const bool exact) const
+{
+    float height;
+    Vector3 normal;
+    if (!exact && SampleSurfaceCache(worldPosition, height, normal))
+        return height;
+
+    PrepareSurfaceQueries();
+    return EvaluateSurface(worldPosition, queryEmitters_.Buffer()).first.y_;
+}
+
+Vector3 Ocean::GetSurfaceNormal(const Vector3& worldPosition, const bool exact) const
+{
+    float height;
+    Vector3 normal;
+    if (!exact && SampleSurfaceCache(worldPosition, height, normal))
+        return normal;
+
+    PrepareSurfaceQueries();
+    return EvaluateSurface(worldPosition, queryEmitters_.Buffer()).second;
+}
+
+void Ocean::PrepareSurfaceQueries() const
+{
+    // The waves of the current frame are prepared once for all queries
+    if (queryWavesDirty_)
+    {
+        PrepareGerstnerWaves(waveSystem_->GetWaves(), queryWaves_);
+        if (waveSpectrum_)
+            waveSpectrum_->GetPhases(spectrumPhaseAngles_, 0.f, querySpectrumPhases_);
+        queryWavesDirty_ = false;
+    }
+    waveSystem_->PrepareEmitterQueries();
+    queryEmitters_.Resize(waveSystem_->GetEmitters().Size());
+
+    // Dirty world transforms are updated on access, which must not happen on the workers
+    if (node_)
+        node_->GetWorldTransform();
+    if (depthTerrain_ && depthTerrain_->GetNode())
+        depthTerrain_->GetNode()->GetWorldTransform();
+}
+
+PositionAndNormal Ocean::EvaluateSurface(const Vector3& worldPosition, unsigned* emitters,
+    const unsigned iterations) const
+{
+    const Matrix3x4 transform = node_ ? node_->GetWorldTransform() : Matrix3x4::IDENTITY;
+    const Vector3 localPosition = transform.Inverse() * worldPosition;
+    const Vector2 target(localPosition.x_, localPosition.z_);
+    const Vector2 shore = depthTerrain_ || depthImage_ ? GetShoreFactor(transform * Vector3(target.x_, 0.f, target.y_)) :
+        Vector2(1.f, 0.f);
+    const GerstnerKernel kernel = GetGerstnerKernel(queryWaves_.Size(), wavePrecision_);
+
+    // The waves move the surface sideways, so search the rest position whose displaced position lies above the queried one
+    Vector2 P = target;
+    PositionAndNormal wave;
+    for (unsigned i = 0; i < Max(iterations, 1u); ++i)
+    {
+        wave = kernel(P, queryWaves_.Buffer(), queryWaves_.Size(), shore.x_, shore.y_);
+        if (waveSpectrum_)
+        {
+            AddSpectrumWaves(P, *waveSpectrum_, querySpectrumPhases_, waveSpectrum_->GetHarmonicCount(), shore.x_, shore.y_,
+                wave);
+        }
+        P += target - Vector2(wave.first.x_, wave.first.y_);
+    }
+
+    const unsigned numEmitters = waveSystem_->QueryEmitters(P, P, emitters);
+    for (unsigned i = 0; i < numEmitters; ++i)
+    {
+        const Vector3 emitterWave = CalculateEmitterWave(P, waveSystem_->GetTime(), waveSystem_->GetEmitters()[emitters[i]]);
+        wave.first.z_ += emitterWave.z_;
+        wave.second.x_ -= emitterWave.x_;
+        wave.second.y_ -= emitterWave.y_;
+    }
+
+    // The waves are calculated in the plane of x and z, with the height in z
+    const Vector3 position(wave.first.x_, wave.first.z_, wave.first.y_);
+    const Vector3 normal(wave.second.x_, wave.second.z_, wave.second.y_);
+    return PositionAndNormal(transform * position, (transform.Rotation() * normal).Normalized());
+}
 
-    // Extract the original vertices and duplicates from the water plane model
-    Geometry* geom = model->GetGeometry(0, 0);
-    waterVertexBuffer_ = geom ? SharedPtr<VertexBuffer>(geom->GetVertexBuffer(0)) : nullptr;
-    if (waterVertexBuffer_)
+void Ocean::SetSurfaceCache(const bool enable)
+{
+    surfaceCacheEnabled_ = enable;
+    if (!enable)
     {
-        originalVertices_ = ExtractVertexPositions(waterVertexBuffer_);
-        vertexDuplicates_ = ExtractDuplicates(originalVertices_);
+        surfaceCacheOrigins_.Clear();
+        surfaceCacheSamples_.Clear();
+        surfaceCacheSamples_.Compact();
     }
 }
 
-void Ocean::HandleUpdate(StringHash eventType, VariantMap& eventData)
+void Ocean::SetSurfaceCacheResolution(const unsigned value)
 {
-    URHO3D_PROFILE(Ocean);
+    // The grids are placed again in the next frame, until then the queries are exact
+    surfaceCacheResolution_ = Clamp(value, 1u, 256u);
+    surfaceCacheOrigins_.Clear();
+}
 
-    using namespace Update;
+void Ocean::SetSurfaceCacheCellSize(const float value)
+{
+    surfaceCacheCellSize_ = Max(value, M_EPSILON);
+    surfaceCacheOrigins_.Clear();
+}
 
-    // Take the frame time step, which is stored as a float
-    float timeStep = eventData[P_TIMESTEP].GetFloat();
+void Ocean::AddSurfaceCacheTarget(Node* node)
+{
+    if (node && !surfaceCacheTargets_.Contains(WeakPtr<Node>(node)))
+        surfaceCacheTargets_.Push(WeakPtr<Node>(node));
+}
 
-    // Increase overall time
-    time_ += timeStep;
+void Ocean::RemoveSurfaceCacheTarget(Node* node)
+{
+    surfaceCacheTargets_.Remove(WeakPtr<Node>(node));
+}
+
+bool Ocean::SampleSurfaceCache(const Vector3& worldPosition, float& height, Vector3& normal) const
+{
+    const unsigned stride = surfaceCacheResolution_ + 1;
+    const float size = static_cast<float>(surfaceCacheResolution_);
+    for (unsigned i = 0; i < surfaceCacheOrigins_.Size(); ++i)
+    {
+        const Vector2 position = (Vector2(worldPosition.x_, worldPosition.z_) - surfaceCacheOrigins_[i]) /
+            surfaceCacheCellSize_;
+        if (position.x_ < 0.f || position.y_ < 0.f || position.x_ > size || position.y_ > size)
+            continue;
+
+        const Vector4 sample = SampleGridBilinear(&surfaceCacheSamples_[i * stride * stride], stride, position);
+        height = sample.x_;
+        normal = Vector3(sample.y_, sample.z_, sample.w_).Normalized();
+        return true;
+    }
+
+    return false;
+}
+
+unsigned Ocean::BeginSurfaceCache()
+{
+    surfaceCacheOrigins_.Clear();
+    if (!surfaceCacheEnabled_ || !node_)
+        return 0;
+
+    // The views only count while they render the ocean, server oceans have none
+    const Time* time = GetSubsystem<Time>();
+    const bool viewsValid = time && viewPositionsFrame_ + 1 >= time->GetFrameNumber();
+    pointsOfInterest_.Clear();
+    if (viewsValid)
+        pointsOfInterest_.Push(viewPositions_);
+    for (auto i = surfaceCacheTargets_.Begin(); i != surfaceCacheTargets_.End();)
+    {
+        if (*i)
+        {
+            pointsOfInterest_.Push((*i)->GetWorldPosition());
+            ++i;
+        }
+        else
+            i = surfaceCacheTargets_.Erase(i);
+    }
+
+    // The grids snap to whole cells, so that a moving point of interest samples the surface at the same places
+    const float halfSize = static_cast<float>(surfaceCacheResolution_ / 2);
+    for (const Vector3& point : pointsOfInterest_)
+    {
+        const Vector2 origin((floorf(point.x_ / surfaceCacheCellSize_) - halfSize) * surfaceCacheCellSize_,
+            (floorf(point.z_ / surfaceCacheCellSize_) - halfSize) * surfaceCacheCellSize_);
+        if (!surfaceCacheOrigins_.Contains(origin))
+            surfaceCacheOrigins_.Push(origin);
+    }
+    if (surfaceCacheOrigins_.Empty())
+        return 0;
+
+    const unsigned stride = surfaceCacheResolution_ + 1;
+    surfaceCacheSamples_.Resize(surfaceCacheOrigins_.Size() * stride * stride);
+    surfaceCachePlaneHeight_ = node_->GetWorldPosition().y_;
+    PrepareSurfaceQueries();
+    return surfaceCacheOrigins_.Size() * stride;
+}
+
+void Ocean::UpdateSurfaceCacheRange(const unsigned begin, const unsigned end, unsigned* emitters)
+{
+    const unsigned stride = surfaceCacheResolution_ + 1;
+    for (unsigned row = begin; row < end; ++row)
+    {
+        const Vector2& origin = surfaceCacheOrigins_[row / stride];
+        const float z = origin.y_ + (row % stride) * surfaceCacheCellSize_;
+        Vector4* samples = &surfaceCacheSamples_[row * stride];
+        for (unsigned i = 0; i < stride; ++i)
+        {
+            const Vector3 position(origin.x_ + i * surfaceCacheCellSize_, surfaceCachePlaneHeight_, z);
+            const PositionAndNormal surface = EvaluateSurface(position, emitters, OCEAN_SURFACE_CACHE_ITERATIONS);
+            samples[i] = Vector4(surface.first.y_, surface.second.x_, surface.second.y_, surface.second.z_);
+        }
+    }
+}
+
+void Ocean::HandleModelReloadFinished(StringHash eventType, VariantMap& eventData)
+{
+    // The old geometry stays rendered and animated until the reloaded model has been prepared
+    SetModel(model_);
+}
+
+void Ocean::HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData)
+{
+    using namespace WorkItemCompleted;
+
+    void* item = eventData[P_ITEM].GetVoidPtr();
+    for (unsigned i = 0; i < meshJobs_.Size(); ++i)
+    {
+        if (meshJobs_[i]->workItem_.Get() != item)
+            continue;
+
+        // Results of jobs that were superseded by a later SetModel are discarded. The latest job is applied even if the
+        // discarded ones have not completed yet
+        SharedPtr<OceanMeshJob> job = meshJobs_[i];
+        meshJobs_.Erase(i);
+        if (!job->discarded_)
+            ApplyMeshJob(*job);
+        return;
+    }
+}
+
+void Ocean::ApplyMeshJob(OceanMeshJob& job)
+{
+    // StaticModel ignores setting the same model again, but a reloaded model has new geometries
+    if (model_)
+        UnsubscribeFromEvent(model_, E_RELOADFINISHED);
+    model_.Reset();
+    StaticModel::SetModel(job.model_);
+
+    // Replace the reload handler of StaticModel, which would rebuild the batches before the data is ready
+    if (job.model_)
+        SubscribeToEvent(job.model_, E_RELOADFINISHED, URHO3D_HANDLER(Ocean, HandleModelReloadFinished));
+
+    // A model that was set after the tile store must have its tiles
+    if (tileStore_ && job.model_ && (tileStore_->GetNumVertices() != job.meshData_.GetNumVertices() ||
+        !tileStore_->MatchesTiles(job.meshData_.tiles_)))
+    {
+        URHO3D_LOGERROR("Ocean tile store does not match the tiles of model " + job.model_->GetName() +
+            ", the static data of the model is used");
+        tileStore_.Reset();
+        streamedTiles_.Clear();
+    }
+
+    waterVertexBuffer_ = job.vertexBuffer_;
+    numVertices_ = job.meshData_.GetNumVertices();
+    if (!tileStore_)
+    {
+        CopyToAlignedArray(job.meshData_.positionsX_, restVertices_.restX_);
+        CopyToAlignedArray(job.meshData_.positionsY_, restVertices_.restY_);
+        CopyToAlignedArray(job.meshData_.positionsZ_, restVertices_.restZ_);
+        restVertices_.duplicates_ = job.meshData_.duplicates_;
+    }
+    tiles_ = job.meshData_.tiles_;
+    gridRows_ = job.meshData_.gridRows_;
+    keyframeInterval_ = 0;
+    MarkDepthChanged();
+}
+
+void Ocean::SetDepthTerrain(Terrain* terrain)
+{
+    depthTerrain_ = terrain;
+    MarkDepthChanged();
+}
+
+void Ocean::SetDepthImage(Image* image, const Rect& area, const float minHeight, const float maxHeight)
+{
+    if (depthImage_)
+        UnsubscribeFromEvent(depthImage_, E_RELOADFINISHED);
+
+    depthImage_ = image;
+    depthImageArea_ = area;
+    depthImageMinHeight_ = minHeight;
+    depthImageMaxHeight_ = maxHeight;
+
+    if (depthImage_)
+        SubscribeToEvent(depthImage_, E_RELOADFINISHED, URHO3D_HANDLER(Ocean, HandleDepthImageReloadFinished));
+    MarkDepthChanged();
+}
+
+void Ocean::MarkDepthChanged(const BoundingBox& worldArea)
+{
+    if (node_)
+        MarkDepthChanged(worldArea, node_->GetWorldTransform());
+}
+
+void Ocean::MarkDepthChanged(const BoundingBox& worldArea, const Matrix3x4& transform)
+{
+    // Compare in world space, the tiles of a rotated or scaled ocean cover a different area than their bounds
+    depthChangedTiles_.Resize(tiles_.Size());
+    for (unsigned i = 0; i < tiles_.Size(); ++i)
+    {
+        if (tiles_[i].bounds_.Transformed(transform).IsInside(worldArea) != OUTSIDE)
+        {
+            depthChangedTiles_[i] = true;
+            depthChanged_ = true;
+        }
+    }
+}
+
+void Ocean::MarkDepthChanged()
+{
+    depthChangedTiles_.Resize(tiles_.Size());
+    for (unsigned i = 0; i < tiles_.Size(); ++i)
+        depthChangedTiles_[i] = true;
+    depthChanged_ = true;
+}
+
+void Ocean::HandleDepthImageReloadFinished(StringHash eventType, VariantMap& eventData)
+{
+    MarkDepthChanged();
+}
+
+void Ocean::UpdateBatches(const FrameInfo& frame)
+{
+    StaticModel::UpdateBatches(frame);
+
+    // A view that shades the surface needs the normals, wireframe views and shadow maps only use the positions. If the
+    // last animation left them out, they are added before this view renders
+    if (frame.camera_ && frame.camera_->GetFillMode() == FILL_SOLID && IsInView(frame, false))
+    {
+        // An ocean that renders the surface of another one checks on the main thread whether that one needs them
+        normalsFrame_ = frame.frameNumber_;
+        if (normalsPending_ || surfaceSource_)
+        {
+            normalsPending_ = false;
+            lateNormals_ = true;
+        }
+    }
+
+    // Remember the views of the last rendered frame, the streamed tiles follow them
+    if ((tileStore_ || surfaceCacheEnabled_) && frame.camera_ && frame.camera_->GetNode())
+    {
+        if (viewPositionsFrame_ != frame.frameNumber_)
+            viewPositions_.Clear();
+        viewPositions_.Push(frame.camera_->GetNode()->GetWorldPosition());
+        viewPositionsFrame_ = frame.frameNumber_;
+    }
+
+    if (!temporalLodEnabled_ || !frame.camera_)
+        return;
+
+    // Estimate the size of the bounding sphere on screen as a fraction of the screen height
+    const BoundingBox& worldBoundingBox = GetWorldBoundingBox();
+    const float radius = worldBoundingBox.HalfSize().Length();
+    float size = 0.f;
+    if (frame.camera_->IsOrthographic())
+    {
+        size = 2.f * radius * frame.camera_->GetZoom() / frame.camera_->GetOrthoSize();
+    }
+    else
+    {
+        const float distance = Max(frame.camera_->GetDistance(worldBoundingBox.Center()) - radius, frame.camera_->GetNearClip());
+        size = radius / (distance * Tan(frame.camera_->GetFov() * 0.5f));
+    }
+
+    // Several views may render the ocean in the same frame, the largest one decides
+    if (projectedSizeFrame_ != frame.frameNumber_)
+        projectedSize_ = size;
+    else
+        projectedSize_ = Max(projectedSize_, size);
+    projectedSizeFrame_ = frame.frameNumber_;
+}
+
+UpdateGeometryType Ocean::GetUpdateGeometryType()
+{
+    // The late normals are uploaded, which needs the main thread
+    return lateNormals_ ? UPDATE_MAIN_THREAD : StaticModel::GetUpdateGeometryType();
+}
+
+void Ocean::UpdateGeometry(const FrameInfo& frame)
+{
+    if (!lateNormals_)
+        return;
+
+    // The first of the oceans that render a shared surface adds its normals, the source may not be in view at all
+    Ocean* source = surfaceSource_;
+    if (!source)
+    {
+        AddLateNormals();
+        return;
+    }
+
+    lateNormals_ = false;
+    if (source->normalsPending_ || source->lateNormals_)
+    {
+        source->normalsPending_ = false;
+        source->AddLateNormals();
+    }
+}
+
+bool Ocean::AreNormalsNeeded() const
+{
+    if (alwaysAnimateNormals_)
+        return true;
+
+    // The views are recorded during rendering, so they belong to the previous frame
+    const Time* time = GetSubsystem<Time>();
+    return time && normalsFrame_ + 1 >= time->GetFrameNumber();
+}
+
+void Ocean::AddLateNormals()
+{
+    // The waves of the animated frame are still prepared. The WaveSystem was updated since, so only the emitters are
+    // collected again and the wave time follows a new epoch
+    lateNormals_ = false;
+    vertexData_ = waterVertexBuffer_ ? waterVertexBuffer_->GetShadowData() : nullptr;
+    if (!vertexData_ || !oceanManager_)
+        return;
+
+    URHO3D_PROFILE(AddOceanNormals);
+
+    FollowWaveEpoch();
+    PrepareEmitters();
+    animateNormals_ = true;
+    animationKernel_ = GetGerstnerKernel(animationWaves_.Size(), wavePrecision_, true);
+    for (auto& changed : changedTiles_)
+        changed = 0;
+
+    // Every tile is committed, the positions barely change but the normals do
+    commitAllTiles_ = true;
+    oceanManager_->AnimateNow(this);
+    commitAllTiles_ = false;
+
+    UploadChangedTiles();
+    vertexData_ = nullptr;
+}
+
+unsigned Ocean::GetTemporalLodInterval() const
+{
+    // The projected size is recorded during rendering, so it belongs to the previous frame if the ocean is visible
+    const Time* time = GetSubsystem<Time>();
+    const bool visible = time && projectedSizeFrame_ + 1 >= time->GetFrameNumber();
+    if (!visible || projectedSize_ <= 0.f)
+        return temporalLodMaxInterval_;
+
+    return static_cast<unsigned>(Clamp(CeilToInt(temporalLodFullRateSize_ / projectedSize_), 1, static_cast<int>(temporalLodMaxInterval_)));
+}
+
+bool Ocean::SharesSurfaceWith(const Ocean& other) const
+{
+    // The depth attenuation is baked for the position of each ocean and cannot be shared
+    return sharedSurfaceEnabled_ && other.sharedSurfaceEnabled_ && model_ && model_ == other.model_ &&
+        waveSystem_ == other.waveSystem_ && waveSpectrum_ == other.waveSpectrum_ && !depthTerrain_ && !depthImage_ && !other.depthTerrain_ && !other.depthImage_ &&
+        !tileStore_ && !other.tileStore_;
+}
+
+bool Ocean::IsSurfacePeriodic() const
+{
+    if (!model_)
+        return false;
+
+    const Vector3 size = model_->GetBoundingBox().Size();
+    return IsPeriodic(Vector2(size.x_, size.z_), waveSystem_->GetWaves());
+}
+
+void Ocean::AddSharedViews(const Ocean& other)
+{
+    normalsFrame_ = Max(normalsFrame_, other.normalsFrame_);
+    if (other.projectedSizeFrame_ > projectedSizeFrame_)
+    {
+        projectedSize_ = other.projectedSize_;
+        projectedSizeFrame_ = other.projectedSizeFrame_;
+    }
+    else if (other.projectedSizeFrame_ == projectedSizeFrame_)
+    {
+        projectedSize_ = Max(projectedSize_, other.projectedSize_);
+    }
+}
+
+void Ocean::AdvanceTime(const float timeStep)
+{
+    // The time follows the WaveSystem, which is updated after the oceans, so oceans that share it never drift apart
+    FollowWaveEpoch();
+    time_ = waveSystem_->GetTime() + timeStep;
+
+    if (waveSpectrum_)
+        waveSpectrum_->AdvancePhases(timeStep, spectrumPhaseAngles_);
+    queryWavesDirty_ = true;
+}
+
+void Ocean::FollowWaveEpoch()
+{
+    // The WaveSystem moves its waves and emitters back by WAVE_TIME_WRAP when it starts a new epoch. The keyframes and
+    // the wave times planned for the frame move along, the late normals are evaluated after the WaveSystem was updated
+    const unsigned epoch = waveSystem_->GetEpoch();
+    if (epoch == timeEpoch_)
+        return;
+
+    const float shift = (static_cast<float>(timeEpoch_) - static_cast<float>(epoch)) * WAVE_TIME_WRAP;
+    time_ += shift;
+    for (auto& keyframe : keyframes_)
+        keyframe.time_ += shift;
+    for (unsigned i = 0; i < numKeyframeTasks_; ++i)
+        keyframeTasks_[i].waveTime_ += shift;
+    animationWaveTime_ += shift;
+    timeEpoch_ = epoch;
+}
+
+bool Ocean::BeginAnimation(const float timeStep)
+{
+    AdvanceTime(timeStep);
 
     if (!waterVertexBuffer_)
+        return false;
+
+    // Let the governor skip frames
+    const bool animate = ++framesSinceAnimation_ >= governor_->GetUpdateInterval();
+    if ((waveSystem_->GetWaves().Empty() && !waveSpectrum_) || !animate)
+        return false;
+
+    // The shadow data holds what was uploaded last, changed tiles are copied into it and uploaded as ranges.
+    // Model vertex buffers are shadowed, the other data (UVs) of the vertices is kept from there
+    vertexData_ = waterVertexBuffer_->GetShadowData();
+    if (!vertexData_)
+        return false;
+
+    framesSinceAnimation_ = 0;
+    vertexSize_ = waterVertexBuffer_->GetVertexSize();
+    normalOffset_ = waterVertexBuffer_->GetElementOffset(SEM_NORMAL, 0);
+    animatedVertices_.Resize(numVertices_);
+    changedTiles_.Resize(tiles_.Size());
+    for (auto& changed : changedTiles_)
+        changed = 0;
+
+    if (depthTransformDirty_)
+        UpdateDepthTransform();
+    if (tileStore_)
+        PrepareStreamedTiles();
+    else if (depthChanged_)
+        BakeDepth();
+    PrepareEmitters();
+    spectrumHarmonics_ = waveSpectrum_ ? governor_->GetMaxWaves(waveSpectrum_->GetHarmonicCount()) : 0;
+
+    // The pending keyframe lies up to two intervals ahead. Where the WaveSystem cannot predict that far, e.g. a replica
+    // shortly before a wave ends, the ocean is evaluated every frame until the successor has been received
+    unsigned interval = temporalLodEnabled_ && !tileStore_ ? GetTemporalLodInterval() : 1;
+    if (interval > 1 && waveSystem_->GetPredictionHorizon() < 2.f * interval * timeStep)
+        interval = 1;
+    animateKeyframes_ = interval > 1;
+
+    // Without a view that shades the surface the positions are animated alone. Keyframes are kept over several frames
+    // and always hold the normals
+    animateNormals_ = animateKeyframes_ || AreNormalsNeeded();
+    normalsPending_ = !animateNormals_;
+    lateNormals_ = false;
+    if (animateKeyframes_)
+    {
+        PlanKeyframes(timeStep, interval);
+    }
+    else
+    {
+        keyframeInterval_ = 0;
+        // The kernel is chosen once per frame for the wave count and the precision
+        PrepareGerstnerWaves(GetGovernedWaves(waveSystem_->GetWaves()), animationWaves_);
+        animationKernel_ = GetGerstnerKernel(animationWaves_.Size(), wavePrecision_, animateNormals_);
+        animationWaveTime_ = waveSystem_->GetTime();
+        if (waveSpectrum_)
+            waveSpectrum_->GetPhases(spectrumPhaseAngles_, 0.f, spectrumPhases_);
+    }
+
+    return true;
+}
+
+void Ocean::AnimateRange(const unsigned begin, const unsigned end)
+{
+    // Tiles outside the streaming distance keep their last shape
+    unsigned first = 0;
+    if (!GetRestVertices(begin, first))
         return;
 
-    // Get the offset for the normals
-    unsigned int normalOffset = waterVertexBuffer_->GetElementOffset(SEM_NORMAL, 0);
+    if (!animateKeyframes_)
+    {
+        // Apply the Gerstner Wave calculations on each vertex in the range
+        EvaluateRange(begin, end, animationKernel_, animationWaves_, animationWaveTime_, spectrumPhases_, animatedVertices_,
+            animateNormals_);
+        CommitRange(begin, end);
+        return;
+    }
+
+    // Evaluate the parts of the planned keyframes that fall into the range
+    for (unsigned i = 0; i < numKeyframeTasks_; ++i)
+    {
+        const KeyframeTask& task = keyframeTasks_[i];
+        EvaluateKeyframe(task, Max(begin, task.begin_), Min(end, task.end_));
+    }
 
-    // Get the active waves from WaveSystem
-    const PODVector<WaveSystem::Wave*>& waves = waveSystem_->GetWaves();
+    // Interpolate linearly between the previous and the next keyframe
+    const Keyframe& previous = keyframes_[keyframeIndex_ % 3];
+    const Keyframe& next = keyframes_[(keyframeIndex_ + 1) % 3];
+    LerpVertexStreams(previous.vertices_, next.vertices_, keyframeFactor_, begin, end, animatedVertices_);
+    CommitRange(begin, end);
+}
 
-    if (waves.Size() > 0)
+void Ocean::EndAnimation(const float msec)
+{
+    UploadChangedTiles();
+    vertexData_ = nullptr;
+    if (tileStore_)
+        tileStore_->EndFrame();
+
+    governor_->AddSample(msec);
+}
+
+void Ocean::CommitRange(const unsigned begin, const unsigned end)
+{
+    // Compare with the positions that were uploaded last
+    const float* positionX = animatedVertices_.positionX_.Buffer();
+    const float* positionY = animatedVertices_.positionY_.Buffer();
+    const float* positionZ = animatedVertices_.positionZ_.Buffer();
+    float maxChange = 0.f;
+    for (unsigned j = begin; j < end; ++j)
+    {
+        const Vector3& uploaded = *reinterpret_cast<const Vector3*>(vertexData_ + j * vertexSize_);
+        const float changeX = Abs(positionX[j] - uploaded.x_);
+        const float changeY = Abs(positionY[j] - uploaded.y_);
+        const float changeZ = Abs(positionZ[j] - uploaded.z_);
+        maxChange = Max(maxChange, Max(changeX, Max(changeY, changeZ)));
+    }
+    if ((maxChange <= uploadThreshold_ && !commitAllTiles_) || begin >= end)
+        return;
+
+    InterleaveVertexStreams(animatedVertices_, begin, end, vertexData_, vertexSize_, normalOffset_, animateNormals_);
+
+    // The ranges are the tiles handed out by the OceanManager, so every tile is only written by one thread
+    for (unsigned tile = FindTile(begin); tile < tiles_.Size() && tiles_[tile].begin_ < end; ++tile)
+        changedTiles_[tile] = 1;
+}
+
+void Ocean::UploadChangedTiles()
+{
+    // The ranges live in the frame arena of the OceanManager. An ocean that has left its scene uploads all vertices
+    SharedPtr<OceanManager> oceanManager = oceanManager_.Lock();
+    if (!oceanManager)
     {
-        // Lock the vertex buffer for update and rewrite positions with sine wave modulated ones
-        // Cannot use discard lock as there is other data (normals, UVs) that we are not overwriting
-        unsigned char* vertexData = (unsigned char*)waterVertexBuffer_->Lock(0, waterVertexBuffer_->GetVertexCount());
-        if (vertexData)
+        waterVertexBuffer_->SetDataRange(vertexData_, 0, numVertices_);
+        numUploadRanges_ = 1;
+        uploadedBytes_ = numVertices_ * vertexSize_;
+        skippedBytes_ = 0;
+        return;
+    }
+
+    // Runs of changed tiles form the ranges, at most one per tile
+    Pair<unsigned, unsigned>* ranges = oceanManager->GetFrameArena().Get().Allocate<Pair<unsigned, unsigned> >(tiles_.Size());
+    unsigned numRanges = 0;
+    for (unsigned i = 0; i < tiles_.Size(); ++i)
+    {
+        if (!changedTiles_[i])
+            continue;
+
+        if (numRanges && ranges[numRanges - 1].second_ == tiles_[i].begin_)
+            ranges[numRanges - 1].second_ = tiles_[i].end_;
+        else
+            ranges[numRanges++] = MakePair(tiles_[i].begin_, tiles_[i].end_);
+    }
+
+    // Close the smallest gaps until there are few enough ranges, uploading some unchanged vertices is cheaper than
+    // many small uploads
+    while (numRanges > maxUploadRanges_)
+    {
+        unsigned smallest = 0;
+        for (unsigned i = 1; i + 1 < numRanges; ++i)
         {
-            unsigned vertexSize = waterVertexBuffer_->GetVertexSize();
-            unsigned numVertices = waterVertexBuffer_->GetVertexCount();
+            if (ranges[i + 1].first_ - ranges[i].second_ < ranges[smallest + 1].first_ - ranges[smallest].second_)
+                smallest = i;
+        }
+        ranges[smallest].second_ = ranges[smallest + 1].second_;
+        for (unsigned i = smallest + 1; i + 1 < numRanges; ++i)
+            ranges[i] = ranges[i + 1];
+        --numRanges;
+    }
+
+    unsigned uploadedVertices = 0;
+    for (unsigned i = 0; i < numRanges; ++i)
+    {
+        const unsigned count = ranges[i].second_ - ranges[i].first_;
+        waterVertexBuffer_->SetDataRange(vertexData_ + ranges[i].first_ * vertexSize_, ranges[i].first_, count);
+        uploadedVertices += count;
+    }
+
+    numUploadRanges_ = numRanges;
+    uploadedBytes_ = uploadedVertices * vertexSize_;
+    skippedBytes_ = (numVertices_ - uploadedVertices) * vertexSize_;
+}
+
+const PODVector<WaveSystem::Wave>& Ocean::GetGovernedWaves(const PODVector<WaveSystem::Wave>& waves)
+{
+    const unsigned maxWaves = governor_->GetMaxWaves(waves.Size());
+    if (maxWaves >= waves.Size())
+        return waves;
+
+    // Dropping the smallest waves changes the surface least, the id breaks ties so the selection does not flicker
+    governedWaves_ = waves;
+    Sort(governedWaves_.Begin(), governedWaves_.End(), CompareWaveAmplitudes);
+    governedWaves_.Resize(maxWaves);
+    return governedWaves_;
+}
+
+void Ocean::PlanKeyframes(const float timeStep, const unsigned interval)
+{
+    const unsigned numVertices = numVertices_;
+    const float keyframeStep = timeStep * interval;
+    numKeyframeTasks_ = 0;
+
+    Keyframe* previous = &keyframes_[keyframeIndex_ % 3];
+    Keyframe* next = &keyframes_[(keyframeIndex_ + 1) % 3];
+    Keyframe* pending = &keyframes_[(keyframeIndex_ + 2) % 3];
+
+    // (Re)initialize the keyframes when the interval changed or the time jumped past the pending keyframe or back, e.g.
+    // when a replica received the time of the server
+    if (keyframeInterval_ != interval || previous->vertices_.Size() != numVertices || time_ >= pending->time_ ||
+        time_ < previous->time_)
+    {
+        previous->time_ = time_;
+        next->time_ = time_ + keyframeStep;
+        pending->time_ = next->time_ + keyframeStep;
+        AddKeyframeTask(*previous, 0, numVertices);
+        AddKeyframeTask(*next, 0, numVertices);
+        keyframeProgress_ = 0;
+        keyframeInterval_ = interval;
+    }
+    else if (time_ >= next->time_)
+    {
+        // Complete the pending keyframe and advance the ring
+        AddKeyframeTask(*pending, keyframeProgress_, numVertices);
+        ++keyframeIndex_;
+        previous = next;
+        next = pending;
+        pending = &keyframes_[(keyframeIndex_ + 2) % 3];
+        pending->time_ = next->time_ + keyframeStep;
+        keyframeProgress_ = 0;
+    }
 
+    // Evaluate the next slice of the pending keyframe, so it is complete after one interval
+    const unsigned sliceSize = (numVertices + interval - 1) / interval;
+    const unsigned sliceEnd = Min(keyframeProgress_ + sliceSize, numVertices);
+    AddKeyframeTask(*pending, keyframeProgress_, sliceEnd);
+    keyframeProgress_ = sliceEnd;
+
+    keyframeFactor_ = Clamp((time_ - previous->time_) / (next->time_ - previous->time_), 0.f, 1.f);
+}
+
+void Ocean::AddKeyframeTask(Keyframe& keyframe, const unsigned begin, const unsigned end)
+{
+    if (begin >= end)
+        return;
+
+    keyframe.vertices_.Resize(numVertices_);
+
+    KeyframeTask& task = keyframeTasks_[numKeyframeTasks_++];
+    task.keyframe_ = &keyframe;
+    task.begin_ = begin;
+    task.end_ = end;
+
+    // The WaveSystem is updated after the ocean, so its time lags behind by the current time step
+    const float offset = keyframe.time_ - time_;
+    task.waveTime_ = waveSystem_->GetTime() + offset;
+    waveSystem_->PredictWaves(offset, keyframeWaves_);
+    PrepareGerstnerWaves(GetGovernedWaves(keyframeWaves_), task.waves_);
+    task.kernel_ = GetGerstnerKernel(task.waves_.Size(), wavePrecision_);
+    if (waveSpectrum_)
+        waveSpectrum_->GetPhases(spectrumPhaseAngles_, offset, task.spectrumPhases_);
+}
+
+void Ocean::EvaluateKeyframe(const KeyframeTask& task, const unsigned begin, const unsigned end) const
+{
+    Keyframe& keyframe = *task.keyframe_;
+    EvaluateRange(begin, end, task.kernel_, task.waves_, task.waveTime_, task.spectrumPhases_, keyframe.vertices_, true);
+}
+
+void Ocean::EvaluateRange(const unsigned begin, const unsigned end, const GerstnerKernel kernel, const PODVector<GerstnerWave>& waves,
+    const float waveTime, const PODVector<Vector2>& spectrumPhases, OceanVertexStreams& result, const bool normals) const
+{
+    unsigned first = 0;
+    const OceanTileData* rest = GetRestVertices(begin, first);
+    if (!rest)
+        return;
+
+    // The recurrence cannot follow the phase lag of the depth attenuation, which changes from vertex to vertex
+    const bool useGridRows = gridRecurrenceEnabled_ && rest->shoreFactors_.Empty();
+
+    // Find the first grid row that ends after begin
+    unsigned row = 0;
+    unsigned numRows = useGridRows ? gridRows_.Size() : 0;
+    while (row < numRows)
+    {
+        const unsigned middle = (row + numRows) / 2;
+        if (gridRows_[middle].end_ <= begin)
+            row = middle + 1;
+        else
+            numRows = middle;
+    }
+    numRows = useGridRows ? gridRows_.Size() : 0;
+
+    PositionAndNormal rowResults[OCEAN_ROW_RESEED];
+    unsigned j = begin;
+    while (j < end)
+    {
+        if (row < numRows && gridRows_[row].begin_ <= j)
+        {
+            const OceanGridRow& gridRow = gridRows_[row];
+            const unsigned count = Min(Min(end, gridRow.end_) - j, OCEAN_ROW_RESEED);
+            const Vector2 origin = gridRow.origin_ + gridRow.step_ * static_cast<float>(j - gridRow.begin_);
+            CalculateGerstnerWavesAlongRow(origin, gridRow.step_, count, waves.Buffer(), waves.Size(), rowResults, normals);
+            for (unsigned i = 0; i < count; ++i, ++j)
             {
-                URHO3D_PROFILE(AnimateVertices);
-                // Apply the Gerstner Wave calculations on each vertex in the water plane
-                for (unsigned j = 0; j < numVertices; ++j)
-                {
-                    Vector3& src = originalVertices_[j];
-                    Vector3& dest = *reinterpret_cast<Vector3*>(vertexData + j * vertexSize);
-                    Vector3& destNormal = *reinterpret_cast<Vector3*>(vertexData + j * vertexSize + normalOffset);
-
-                    // Calculate the new vertex position and normals
-                    std::pair<Vector3, Vector3> gerstnerWave = CalculateGerstnerWaves(Vector2(src.x_, src.z_), time_, waves);
-                    const Vector3 position = gerstnerWave.first;
-                    const Vector3 normal = gerstnerWave.second;
-                    dest = Vector3(position.x_, position.z_, position.y_);
-                    destNormal = Vector3(normal.x_, normal.z_, normal.y_);
-                }
+                const PositionAndNormal vertex = FinishVertex(j, *rest, j - first, rowResults[i], waveTime, spectrumPhases,
+                    normals);
+                if (normals)
+                    result.Set(j, vertex);
+                else
+                    result.SetPosition(j, vertex.first);
             }
+            if (j >= gridRow.end_)
+                ++row;
+            continue;
+        }
 
-            waterVertexBuffer_->Unlock();
+        // Evaluate the vertices up to the next grid row one by one
+        const unsigned next = row < numRows ? Min(end, gridRows_[row].begin_) : end;
+        for (; j < next; ++j)
+        {
+            const unsigned restIndex = j - first;
+            const Vector2 P(rest->restX_[restIndex], rest->restZ_[restIndex]);
+            const Vector2 shore = rest->shoreFactors_.Empty() ? Vector2(1.f, 0.f) : rest->shoreFactors_[restIndex];
+            const PositionAndNormal vertex = FinishVertex(j, *rest, restIndex,
+                kernel(P, waves.Buffer(), waves.Size(), shore.x_, shore.y_), waveTime, spectrumPhases, normals);
+            if (normals)
+                result.Set(j, vertex);
+            else
+                result.SetPosition(j, vertex.first);
         }
     }
+}
+
+const OceanTileData* Ocean::GetRestVertices(const unsigned index, unsigned& first) const
+{
+    if (!tileStore_)
+    {
+        first = 0;
+        return &restVertices_;
+    }
+
+    // While streaming, the ranges are single tiles, which may differ in size
+    const unsigned tile = FindTile(index);
+    if (tile >= streamedTiles_.Size())
+        return nullptr;
+
+    first = tiles_[tile].begin_;
+    return streamedTiles_[tile];
+}
+
+PositionAndNormal Ocean::FinishVertex(const unsigned index, const OceanTileData& rest, const unsigned restIndex,
+    PositionAndNormal gerstnerWave, const float waveTime, const PODVector<Vector2>& spectrumPhases, const bool normals) const
+{
+    const Vector2 P(rest.restX_[restIndex], rest.restZ_[restIndex]);
+    const Vector2 shore = rest.shoreFactors_.Empty() ? Vector2(1.f, 0.f) : rest.shoreFactors_[restIndex];
+
+    if (waveSpectrum_)
+        AddSpectrumWaves(P, *waveSpectrum_, spectrumPhases, spectrumHarmonics_, shore.x_, shore.y_, gerstnerWave, normals);
+    AddEmitterWaves(index, P, waveTime, gerstnerWave);
+
+    // The waves are calculated in the plane of x and z, with the height in z
+    const Vector3& position = gerstnerWave.first;
+    const Vector3& normal = gerstnerWave.second;
+    return PositionAndNormal(Vector3(position.x_, position.z_, position.y_), Vector3(normal.x_, normal.z_, normal.y_));
+}
+
+float Ocean::GetGroundHeight(const Vector3& worldPosition) const
+{
+    if (depthTerrain_)
+        return depthTerrain_->GetHeight(worldPosition);
+
+    if (depthImage_)
+    {
+        const Vector2 size = depthImageArea_.max_ - depthImageArea_.min_;
+        const float u = (worldPosition.x_ - depthImageArea_.min_.x_) / size.x_;
+        const float v = (worldPosition.z_ - depthImageArea_.min_.y_) / size.y_;
+        if (u >= 0.f && u <= 1.f && v >= 0.f && v <= 1.f)
+            return Lerp(depthImageMinHeight_, depthImageMaxHeight_, depthImage_->GetPixelBilinear(u, v).r_);
+    }
+
+    return -M_INFINITY;
+}
+
+bool Ocean::SetTileStore(const String& fileName)
+{
+    if (fileName.Empty())
+    {
+        if (!tileStore_)
+            return true;
+
+        // Prepare the static data of the model again. The store released it, so the animation stops until the mesh job
+        // has installed it, the surface keeps its last shape
+        tileStore_.Reset();
+        streamedTiles_.Clear();
+        waterVertexBuffer_.Reset();
+        numVertices_ = 0;
+        keyframeInterval_ = 0;
+        if (model_)
+            SetModel(model_);
+        return true;
+    }
 
-    // Update the WaveSystem
-    waveSystem_->Update(timeStep);
+    SharedPtr<OceanTileStore> tileStore(new OceanTileStore(context_));
+    if (!tileStore->Open(fileName))
+        return false;
+    if (model_ && (tileStore->GetNumVertices() != numVertices_ || !tileStore->MatchesTiles(tiles_)))
+    {
+        URHO3D_LOGERROR("Ocean tile store " + fileName + " does not match the tiles of the model");
+        return false;
+    }
+
+    tileStore_ = tileStore;
+    keyframeInterval_ = 0;
+
+    // The store provides the static data from now on
+    restVertices_.restX_.Release();
+    restVertices_.restY_.Release();
+    restVertices_.restZ_.Release();
+    restVertices_.duplicates_.Clear();
+    restVertices_.duplicates_.Compact();
+    restVertices_.shoreFactors_.Clear();
+    restVertices_.shoreFactors_.Compact();
+    return true;
+}
+
+bool Ocean::SaveTileStore(const String& fileName)
+{
+    // The data of the model is only resident while not streaming
+    if (tileStore_ || restVertices_.GetNumVertices() != numVertices_ || !numVertices_)
+        return false;
+
+    if (depthTransformDirty_)
+        UpdateDepthTransform();
+    if (depthChanged_)
+        BakeDepth();
+    return SaveOceanTileStore(context_, fileName, tiles_, restVertices_);
+}
+
+void Ocean::PrepareStreamedTiles()
+{
+    streamedTiles_.Resize(tiles_.Size());
+    for (auto& tile : streamedTiles_)
+        tile = nullptr;
+    if (!node_ || tileStore_->GetNumTiles() != tiles_.Size())
+        return;
+
+    // The distances are measured in the space of the model
+    const Matrix3x4 inverse = node_->GetWorldTransform().Inverse();
+    const Vector3 scale = node_->GetWorldScale();
+    const float distance = streamingDistance_ / Max(Min(scale.x_, scale.z_), M_EPSILON);
+    for (const Vector3& viewPosition : viewPositions_)
+    {
+        const Vector3 position = inverse * viewPosition;
+        tileStore_->Prefetch(position, distance * 1.5f);
+        for (unsigned i = 0; i < tiles_.Size(); ++i)
+        {
+            if (!streamedTiles_[i] && GetBoxDistance(tiles_[i].bounds_, position) <= distance)
+                streamedTiles_[i] = tileStore_->RequestTile(i);
+        }
+    }
+}
+
+void Ocean::BakeDepth()
+{
+    depthChanged_ = false;
+    PODVector<Vector2>& shoreFactors = restVertices_.shoreFactors_;
+    if ((!depthTerrain_ && !depthImage_) || !node_)
+    {
+        shoreFactors.Clear();
+        return;
+    }
+
+    const AlignedFloatArray& restX = restVertices_.restX_;
+    const AlignedFloatArray& restY = restVertices_.restY_;
+    const AlignedFloatArray& restZ = restVertices_.restZ_;
+    shoreFactors.Resize(restX.Size());
+    const Matrix3x4& transform = node_->GetWorldTransform();
+    depthTransform_ = transform;
+    for (unsigned i = 0; i < tiles_.Size(); ++i)
+    {
+        if (!depthChangedTiles_[i])
+            continue;
+
+        depthChangedTiles_[i] = false;
+        for (unsigned j = tiles_[i].begin_; j < tiles_[i].end_; ++j)
+            shoreFactors[j] = GetShoreFactor(transform * Vector3(restX[j], restY[j], restZ[j]));
+    }
+}
+
+Vector2 Ocean::GetShoreFactor(const Vector3& worldPosition) const
+{
+    // Waves shrink towards the shore and their crests fall behind, so that they bend towards it
+    const float depth = worldPosition.y_ - GetGroundHeight(worldPosition);
+    const float ratio = Clamp(depth / shoreDepth_, 0.f, 1.f);
+    return Vector2(ratio, (1.f - ratio) * shoreDepth_);
+}
+
+void Ocean::PrepareEmitters()
+{
+    tileEmitterOffsets_.Clear();
+    tileEmitters_.Clear();
+    if (waveSystem_->GetEmitters().Empty())
+        return;
+
+    // Each vertex only evaluates the emitters that overlap its tile. The query writes behind the indices of the previous
+    // tiles, then the list is cut to what it found
+    const unsigned numEmitters = waveSystem_->GetEmitters().Size();
+    tileEmitterOffsets_.Reserve(tiles_.Size() + 1);
+    tileEmitterOffsets_.Push(0);
+    for (const auto& tile : tiles_)
+    {
+        const Vector3& min = tile.bounds_.min_;
+        const Vector3& max = tile.bounds_.max_;
+        const unsigned offset = tileEmitters_.Size();
+        tileEmitters_.Resize(offset + numEmitters);
+        tileEmitters_.Resize(offset + waveSystem_->QueryEmitters(Vector2(min.x_, min.z_), Vector2(max.x_, max.z_),
+            &tileEmitters_[offset]));
+        tileEmitterOffsets_.Push(tileEmitters_.Size());
+    }
+}
+
+unsigned Ocean::FindTile(const unsigned index) const
+{
+    // The tiles are sorted by their first vertex but may differ in size, e.g. when they come from a tile store
+    unsigned low = 0;
+    unsigned high = tiles_.Size();
+    while (high - low > 1)
+    {
+        const unsigned middle = (low + high) / 2;
+        if (tiles_[middle].begin_ <= index)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low < tiles_.Size() && tiles_[low].begin_ <= index && index < tiles_[low].end_ ? low : M_MAX_UNSIGNED;
+}
+
+void Ocean::AddEmitterWaves(const unsigned index, const Vector2& P, const float waveTime, PositionAndNormal& wave) const
+{
+    if (tileEmitterOffsets_.Empty())
+        return;
+
+    const unsigned tile = FindTile(index);
+    if (tile == M_MAX_UNSIGNED)
+        return;
+
+    const PODVector<WaveSystem::Emitter>& emitters = waveSystem_->GetEmitters();
+    for (unsigned i = tileEmitterOffsets_[tile]; i < tileEmitterOffsets_[tile + 1]; ++i)
+    {
+        const Vector3 emitterWave = CalculateEmitterWave(P, waveTime, emitters[tileEmitters_[i]]);
+        wave.first.z_ += emitterWave.z_;
+        wave.second.x_ -= emitterWave.x_;
+        wave.second.y_ -= emitterWave.y_;
+    }
+}
+
+Vector2 Ocean::GetWavePlanePosition(const Vector3& worldPosition) const
+{
+    const Vector3 localPosition = node_ ? node_->GetWorldTransform().Inverse() * worldPosition : worldPosition;
+    return Vector2(localPosition.x_, localPosition.z_);
+}
+
+void Ocean::OnMarkedDirty(Node* node)
+{
+    StaticModel::OnMarkedDirty(node);
+
+    // The transform is compared before the next bake, the node is also marked dirty without moving, e.g. by its parent
+    if (depthTerrain_ || depthImage_)
+        depthTransformDirty_ = true;
+}
+
+void Ocean::UpdateDepthTransform()
+{
+    depthTransformDirty_ = false;
+    if (!node_)
+        return;
+
+    const Matrix3x4& transform = node_->GetWorldTransform();
+    if (transform.Equals(depthTransform_))
+        return;
+
+    // A moved, rotated or scaled ocean lies over other ground. A terrain extends its edges, so every tile is affected.
+    // Outside of a depth image the water is deep, only the tiles over the image before or after the move change
+    if (depthImage_ && !depthTerrain_)
+    {
+        const BoundingBox imageArea(Vector3(depthImageArea_.min_.x_, -M_INFINITY, depthImageArea_.min_.y_),
+            Vector3(depthImageArea_.max_.x_, M_INFINITY, depthImageArea_.max_.y_));
+        MarkDepthChanged(imageArea, depthTransform_);
+        MarkDepthChanged(imageArea, transform);
+    }
+    else
+        MarkDepthChanged();
+    depthTransform_ = transform;
+}
+
+void Ocean::OnSceneSet(Scene* scene)
+{
+    StaticModel::OnSceneSet(scene);
+
+    // The OceanManager of the scene owns the update of all oceans
+    if (scene)
+    {
+        oceanManager_ = scene->GetOrCreateComponent<OceanManager>(LOCAL);
+        if (oceanManager_)
+            oceanManager_->AddOcean(this);
+    }
+    else if (oceanManager_)
+    {
+        oceanManager_->RemoveOcean(this);
+        oceanManager_.Reset();
+    }
 }
 
 }
@@ -24,12 +24,22 @@
 
 #include <Urho3D/Graphics/StaticModel.h>
 
+#include "OceanAlgorithms.h"
+#include "OceanGovernor.h"
+#include "OceanTileStore.h"
 #include "WaveSystem.h"
 
 namespace Urho3D
 {
 
+class Image;
 class Model;
+class OceanManager;
+class Terrain;
+struct OceanMeshJob;
+
+/// Default number of iterations that search the rest position below a queried surface position
+static const unsigned OCEAN_QUERY_ITERATIONS = 4;
 
 /// Ocean component.
 class URHO3D_API Ocean : public StaticModel
@@ -43,27 +53,410 @@ public:
     /// Register object factory. Drawable must be registered first.
     static void RegisterObject(Context* context);
 
-    /// Set the model to use as the water plane
+    /// Calculate distance and prepare batches for rendering. Also records the projected size for the temporal LOD and
+    /// whether the view shades the surface
+    virtual void UpdateBatches(const FrameInfo& frame) override;
+    /// Returns the main thread while normals have to be added for a view
+    virtual UpdateGeometryType GetUpdateGeometryType() override;
+    /// Adds the normals that a view needs to a frame that was animated without them
+    virtual void UpdateGeometry(const FrameInfo& frame) override;
+
+    /// Set the model to use as the water plane. The mesh data is prepared in the background, until it is ready
+    /// the previous model keeps animating, or the new model is shown flat if there was none. In server mode the model is
+    /// only remembered until the server mode is disabled
     void SetModel(Model* model);
 
+    /// Enable the server mode for a process that never renders, e.g. a dedicated server. The ocean then releases its
+    /// mesh and is no longer animated, only its time advances and the surface is evaluated when it is queried. Disabling
+    /// it prepares the mesh of the last set model again
+    void SetServerMode(const bool enable);
+    bool IsServerMode() const { return serverMode_; }
+    /// Returns the world height of the surface above a world position, including the spectrum, the local emitters and
+    /// the shore. Inside the surface cache the height is interpolated from it, unless exact is set. Elsewhere the surface
+    /// is evaluated on demand, also in server mode. Call from the main thread only
+    float GetSurfaceHeight(const Vector3& worldPosition, const bool exact = false) const;
+    /// Returns the world normal of the surface above a world position
+    Vector3 GetSurfaceNormal(const Vector3& worldPosition, const bool exact = false) const;
+    /// Prepares the waves of the current frame for queries. Afterwards EvaluateSurface may be called from worker threads
+    /// until the time of the ocean advances
+    void PrepareSurfaceQueries() const;
+    /// Evaluates the surface above a world position and returns its world position and normal. emitters is scratch
+    /// memory of the calling thread for an index of every emitter, iterations is the number of steps that search the
+    /// displaced rest position
+    PositionAndNormal EvaluateSurface(const Vector3& worldPosition, unsigned* emitters,
+        const unsigned iterations = OCEAN_QUERY_ITERATIONS) const;
+
+    /// Enable the surface cache, a coarse grid of surface heights and normals around the views and the cache targets.
+    /// It is evaluated once per frame together with the animation, queries inside it interpolate bilinearly
+    void SetSurfaceCache(const bool enable);
+    bool IsSurfaceCacheEnabled() const { return surfaceCacheEnabled_; }
+    /// Set the number of cells along each side of the grid around a point of interest
+    void SetSurfaceCacheResolution(const unsigned value);
+    unsigned GetSurfaceCacheResolution() const { return surfaceCacheResolution_; }
+    /// Set the size of a cell in world units
+    void SetSurfaceCacheCellSize(const float value);
+    float GetSurfaceCacheCellSize() const { return surfaceCacheCellSize_; }
+    /// Add a node whose surroundings are cached as well, e.g. a ship that spreads spray and debris around it
+    void AddSurfaceCacheTarget(Node* node);
+    /// Remove a node added by AddSurfaceCacheTarget
+    void RemoveSurfaceCacheTarget(Node* node);
+    /// Interpolates the height and the world normal of the surface above a world position from the surface cache.
+    /// Returns false if the position is outside of it. May be called from any thread outside of the ocean update
+    bool SampleSurfaceCache(const Vector3& worldPosition, float& height, Vector3& normal) const;
+    /// Places the grids of the surface cache for this frame and returns their number of rows, 0 if the cache is disabled
+    unsigned BeginSurfaceCache();
+    /// Evaluates the rows between begin and end of the surface cache. May be called from worker threads for disjoint
+    /// rows, emitters is scratch memory of the calling thread for an index of every emitter
+    void UpdateSurfaceCacheRange(const unsigned begin, const unsigned end, unsigned* emitters);
+
+    /// Returns true while the mesh data of a model is prepared in the background
+    bool IsModelPending() const { return !meshJobs_.Empty(); }
+
+    /// Always animate the normals. Otherwise they are only animated while a view with solid fill rendered the ocean in the
+    /// last frame, and the positions are animated alone for wireframe views, shadow maps and oceans out of view. A view
+    /// that needs the normals after such a frame has them added before it renders
+    void SetAlwaysAnimateNormals(const bool enable) { alwaysAnimateNormals_ = enable; }
+    bool GetAlwaysAnimateNormals() const { return alwaysAnimateNormals_; }
+    /// Returns true if the last animated frame included the normals
+    bool AreNormalsAnimated() const { return animateNormals_; }
+
+    /// Enable the temporal LOD. Small or invisible oceans are then evaluated at a lower rate and interpolated
+    void SetTemporalLod(const bool enable) { temporalLodEnabled_ = enable; }
+    bool IsTemporalLodEnabled() const { return temporalLodEnabled_; }
+    /// Set the projected size, as a fraction of the screen height, from which the ocean is evaluated every frame
+    void SetTemporalLodFullRateSize(const float value) { temporalLodFullRateSize_ = value; }
+    float GetTemporalLodFullRateSize() const { return temporalLodFullRateSize_; }
+    /// Set the maximum number of frames between two evaluated keyframes
+    void SetTemporalLodMaxInterval(const unsigned value) { temporalLodMaxInterval_ = Max(value, 1u); }
+    unsigned GetTemporalLodMaxInterval() const { return temporalLodMaxInterval_; }
+    /// Returns the number of frames between two evaluated keyframes chosen for the current projected size
+    unsigned GetTemporalLodInterval() const;
+
+    /// Enable the shared surface. Oceans with the same model render the same vertex buffer, so Urho3D draws them as
+    /// instances of one batch. If enabled, the surface is computed once for all of them that also share the WaveSystem.
+    /// The tiles only join without seams if the waves repeat over the model size, see WaveSystem::SetTileSize
+    void SetSharedSurface(const bool enable) { sharedSurfaceEnabled_ = enable; }
+    bool IsSharedSurfaceEnabled() const { return sharedSurfaceEnabled_; }
+    /// Returns true if both oceans have the shared surface enabled and would compute the same surface
+    bool SharesSurfaceWith(const Ocean& other) const;
+    /// Returns true if the active waves repeat over the size of the model
+    bool IsSurfacePeriodic() const;
+    /// Takes over the projected size and the shading views of another ocean that renders the surface computed by this one
+    void AddSharedViews(const Ocean& other);
+    /// Set the ocean whose surface this one renders in the current frame, null if it computes its own. Called by
+    /// OceanManager
+    void SetSurfaceSource(Ocean* source) { surfaceSource_ = source; }
+    Ocean* GetSurfaceSource() const { return surfaceSource_; }
+
+    /// Set the precision of the sine and cosine of the waves. The polynomial precisions are cheaper than the exact one
+    void SetWavePrecision(const WavePrecision precision) { wavePrecision_ = precision; }
+    WavePrecision GetWavePrecision() const { return wavePrecision_; }
+
+    /// Enable the evaluation of grid rows by a trigonometric recurrence. It is only used where there is no depth attenuation
+    void SetGridRecurrence(const bool enable) { gridRecurrenceEnabled_ = enable; }
+    bool IsGridRecurrenceEnabled() const { return gridRecurrenceEnabled_; }
+    /// Returns the runs of vertices with a constant step that were found in the model
+    const PODVector<OceanGridRow>& GetGridRows() const { return gridRows_; }
+
+    /// Set the largest change of a vertex position, below which a tile is not uploaded again
+    void SetUploadThreshold(const float value) { uploadThreshold_ = Max(value, 0.f); }
+    float GetUploadThreshold() const { return uploadThreshold_; }
+    /// Set the maximum number of vertex ranges uploaded per frame, neighbouring ranges are merged to stay below it
+    void SetMaxUploadRanges(const unsigned value) { maxUploadRanges_ = Max(value, 1u); }
+    unsigned GetMaxUploadRanges() const { return maxUploadRanges_; }
+    /// Returns the bytes uploaded in the last animated frame
+    unsigned GetUploadedBytes() const { return uploadedBytes_; }
+    /// Returns the bytes that were not uploaded in the last animated frame, because their tiles barely changed
+    unsigned GetSkippedBytes() const { return skippedBytes_; }
+    /// Returns the number of ranges uploaded in the last animated frame
+    unsigned GetNumUploadRanges() const { return numUploadRanges_; }
+
+    /// Returns the ranges of consecutive vertices that can be animated independently
+    const PODVector<OceanTile>& GetTiles() const { return tiles_; }
+    /// Returns the vertex buffer that the animation writes, oceans of the same model share it
+    VertexBuffer* GetWaterVertexBuffer() const { return waterVertexBuffer_; }
+    /// Advances the time and prepares the animation of this frame. Returns false if nothing needs to be animated
+    bool BeginAnimation(const float timeStep);
+    /// Animates the vertices between begin and end. May be called from worker threads for disjoint tiles
+    void AnimateRange(const unsigned begin, const unsigned end);
+    /// Finishes the animation of this frame, msec is the share of the measured update cost
+    void EndAnimation(const float msec);
+    /// Advances the time without animating, while another ocean computes the shared surface
+    void SkipAnimation(const float timeStep) { AdvanceTime(timeStep); }
+
+    /// Use a Terrain as the ground below the ocean. Waves shrink and lag behind where the water is shallow
+    void SetDepthTerrain(Terrain* terrain);
+    /// Use an image as the ground below the ocean. The red channel maps to heights between minHeight and maxHeight,
+    /// the image covers the area between area.min_ and area.max_ in world x and z
+    void SetDepthImage(Image* image, const Rect& area, const float minHeight, const float maxHeight);
+    /// Set the water depth from which waves are no longer affected by the ground
+    void SetShoreDepth(const float value) { shoreDepth_ = Max(value, M_EPSILON); MarkDepthChanged(); }
+    float GetShoreDepth() const { return shoreDepth_; }
+    /// Rebakes the depth attenuation of the tiles that overlap a world space area, after the ground changed there
+    void MarkDepthChanged(const BoundingBox& worldArea);
+    /// Rebakes the depth attenuation of all tiles
+    void MarkDepthChanged();
+
+    /// Page the static tile data in from a tile store file written by SaveTileStore, instead of keeping it for the whole
+    /// model. Only the tiles within the streaming distance of a view are animated, the others keep their last shape. The
+    /// depth attenuation baked into the file is used and temporal LOD keyframes are not. Only the rest positions,
+    /// duplicates and shore factors are streamed, the model, its vertex buffer and the animated vertices stay resident.
+    /// Fails if the tiles of the file differ from those of the model. An empty name keeps the data of the model resident
+    /// again
+    bool SetTileStore(const String& fileName);
+    OceanTileStore* GetTileStore() const { return tileStore_; }
+    /// Write the static data of the model and its baked depth attenuation into a tile store file
+    bool SaveTileStore(const String& fileName);
+    /// Set the distance from the views within which tiles are animated. Tiles up to half as far again are prefetched
+    void SetStreamingDistance(const float value) { streamingDistance_ = Max(value, 0.f); }
+    float GetStreamingDistance() const { return streamingDistance_; }
+
+    /// Returns the position in the plane of the waves, e.g. to place local emitters of the WaveSystem
+    Vector2 GetWavePlanePosition(const Vector3& worldPosition) const;
+
+    /// Set the WaveSystem. Oceans that share a WaveSystem are animated from the same waves
+    void SetWaveManager(WaveSystem* waveSystem) { if (waveSystem) waveSystem_ = waveSystem; queryWavesDirty_ = true; }
     SharedPtr<WaveSystem> GetWaveManager() { return waveSystem_; }
+    /// Set a WaveSpectrum whose waves are added to those of the WaveSystem, or null to remove it
+    void SetWaveSpectrum(WaveSpectrum* waveSpectrum) { waveSpectrum_ = waveSpectrum; queryWavesDirty_ = true; }
+    SharedPtr<WaveSpectrum> GetWaveSpectrum() { return waveSpectrum_; }
+    /// Returns the governor that keeps the update cost inside a budget. It is disabled until a budget is set
+    SharedPtr<OceanGovernor> GetGovernor() { return governor_; }
+
+protected:
+    /// Handle scene being assigned.
+    virtual void OnSceneSet(Scene* scene) override;
+    /// Handle node transform being dirtied.
+    virtual void OnMarkedDirty(Node* node) override;
 
 private:
-    /// Handle the logic update event.
-    void HandleUpdate(StringHash eventType, VariantMap& eventData);
     /// Handle model reload finished.
     void HandleModelReloadFinished(StringHash eventType, VariantMap& eventData);
+    /// Handle the reload of the depth image.
+    void HandleDepthImageReloadFinished(StringHash eventType, VariantMap& eventData);
+    /// Handle a completed background job and apply the mesh data if it belongs to the latest model.
+    void HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData);
+    /// Switch the rendered model and the animation data in the same frame
+    void ApplyMeshJob(OceanMeshJob& job);
+
+    /// Stores the evaluated surface at a point in time
+    struct Keyframe
+    {
+        float time_ = 0.f;
+        OceanVertexStreams vertices_;
+    };
+
+    /// A range of a keyframe to evaluate in this frame
+    struct KeyframeTask
+    {
+        Keyframe* keyframe_ = nullptr;
+        unsigned begin_ = 0;
+        unsigned end_ = 0;
+        /// Waves predicted for the time of the keyframe and the kernel for their count
+        PODVector<GerstnerWave> waves_;
+        GerstnerKernel kernel_ = nullptr;
+        /// Time of the keyframe in the WaveSystem
+        float waveTime_ = 0.f;
+        /// Phases of the WaveSpectrum at the time of the keyframe
+        PODVector<Vector2> spectrumPhases_;
+    };
+
+    /// Advances the time of the keyframes and the phases of the WaveSpectrum
+    void AdvanceTime(const float timeStep);
+    /// Moves the times of the keyframes and of the evaluation into a new epoch of the WaveSystem
+    void FollowWaveEpoch();
+    /// Returns the waves to evaluate after the governor limited their count to the ones of the highest amplitude
+    const PODVector<WaveSystem::Wave>& GetGovernedWaves(const PODVector<WaveSystem::Wave>& waves);
+    /// Advances the keyframe ring and plans which keyframe ranges are evaluated in this frame
+    void PlanKeyframes(const float timeStep, const unsigned interval);
+    /// Plans the evaluation of the vertices between begin and end of a keyframe
+    void AddKeyframeTask(Keyframe& keyframe, const unsigned begin, const unsigned end);
+    /// Evaluates the vertices between begin and end of a keyframe
+    void EvaluateKeyframe(const KeyframeTask& task, const unsigned begin, const unsigned end) const;
+    /// Copies the animated vertices of a range into the shadow data if the largest change exceeds the threshold
+    void CommitRange(const unsigned begin, const unsigned end);
+    /// Merges the changed tiles into ranges and uploads them
+    void UploadChangedTiles();
+    /// Returns true if a view needs the normals of this frame
+    bool AreNormalsNeeded() const;
+    /// Animates the normals of a frame that was animated without them
+    void AddLateNormals();
+    /// Returns the static data that holds a vertex and the index of its first vertex there, or null while it is not streamed
+    const OceanTileData* GetRestVertices(const unsigned index, unsigned& first) const;
+    /// Evaluates all waves at the vertices between begin and end into the same range of result. Without normals only the
+    /// positions are written, the kernel must match
+    void EvaluateRange(const unsigned begin, const unsigned end, const GerstnerKernel kernel, const PODVector<GerstnerWave>& waves,
+        const float waveTime, const PODVector<Vector2>& spectrumPhases, OceanVertexStreams& result, const bool normals) const;
+    /// Adds the spectrum and the local emitters to the Gerstner waves of a vertex, returns the position and normal in the
+    /// space of the model. rest holds the static data of the vertex at restIndex
+    PositionAndNormal FinishVertex(const unsigned index, const OceanTileData& rest, const unsigned restIndex,
+        PositionAndNormal gerstnerWave, const float waveTime, const PODVector<Vector2>& spectrumPhases,
+        const bool normals) const;
+    /// Requests the static data of the tiles within the streaming distance of the views
+    void PrepareStreamedTiles();
+    /// Returns the height of the ground at a world position, or -M_INFINITY if there is no ground
+    float GetGroundHeight(const Vector3& worldPosition) const;
+    /// Returns the amplitude factor and the phase lag of the waves at a world position of the water plane
+    Vector2 GetShoreFactor(const Vector3& worldPosition) const;
+    /// Marks the tiles whose area under a transform overlaps a world area for baking
+    void MarkDepthChanged(const BoundingBox& worldArea, const Matrix3x4& transform);
+    /// Marks the tiles for baking that the last change of the transform moved over other ground
+    void UpdateDepthTransform();
+    /// Bakes the depth attenuation of the tiles that are marked as changed
+    void BakeDepth();
+    /// Collects the local emitters that overlap each tile
+    void PrepareEmitters();
+    /// Returns the index of the tile that holds a vertex, M_MAX_UNSIGNED if no tile does
+    unsigned FindTile(const unsigned index) const;
+    /// Adds the local emitters that overlap the tile of a vertex at the WaveSystem time waveTime
+    void AddEmitterWaves(const unsigned index, const Vector2& P, const float waveTime, PositionAndNormal& wave) const;
 
     /// Water plane's vertex buffer that we will animate.
     SharedPtr<VertexBuffer> waterVertexBuffer_;
-    /// Stores the original vertices of the water plane model
-    PODVector<Vector3> originalVertices_;
-    /// Stores vertex duplicates
-    PODVector<unsigned> vertexDuplicates_;
+    /// Number of vertices of the water plane model
+    unsigned numVertices_ = 0;
+    /// Rest positions, vertex duplicates and baked depth attenuation of the whole model, empty while streaming
+    OceanTileData restVertices_;
+    /// Ranges of consecutive vertices and their rest bounds
+    PODVector<OceanTile> tiles_;
+    /// Runs of vertices with a constant step
+    PODVector<OceanGridRow> gridRows_;
+    bool gridRecurrenceEnabled_ = true;
+    /// Background jobs that prepare mesh data, the last one belongs to the latest model
+    Vector<SharedPtr<OceanMeshJob> > meshJobs_;
 
     SharedPtr<WaveSystem> waveSystem_;
+    SharedPtr<WaveSpectrum> waveSpectrum_;
+    SharedPtr<OceanGovernor> governor_;
+    /// Subset of the active waves that is evaluated when the governor limits the wave count
+    PODVector<WaveSystem::Wave> governedWaves_;
+    /// Precision of the sine and cosine in the kernels
+    WavePrecision wavePrecision_ = WAVE_PRECISION_EXACT;
+    /// Compute the surface once for all oceans with the same model and WaveSystem
+    bool sharedSurfaceEnabled_ = false;
+    /// Frames since the vertices were last animated
+    unsigned framesSinceAnimation_ = 0;
+
+    /// Ground below the ocean
+    WeakPtr<Terrain> depthTerrain_;
+    SharedPtr<Image> depthImage_;
+    Rect depthImageArea_;
+    float depthImageMinHeight_ = 0.f;
+    float depthImageMaxHeight_ = 0.f;
+    float shoreDepth_ = 5.f;
+    /// Tiles whose depth attenuation needs to be baked again
+    PODVector<bool> depthChangedTiles_;
+    bool depthChanged_ = false;
+    /// World transform of the last bake of the depth attenuation
+    Matrix3x4 depthTransform_;
+    /// Set when the node was marked dirty since the transform was compared
+    bool depthTransformDirty_ = false;
+
+    /// Local emitters that overlap each tile in this frame. Tile i uses the emitters in tileEmitters_
+    /// from tileEmitterOffsets_[i] up to tileEmitterOffsets_[i + 1]
+    PODVector<unsigned> tileEmitterOffsets_;
+    PODVector<unsigned> tileEmitters_;
+
+    /// Static tile data paged in from a file, null if the data of the model is resident
+    SharedPtr<OceanTileStore> tileStore_;
+    float streamingDistance_ = 500.f;
+    /// World positions of the views that rendered the ocean, the streamed tiles and the surface cache follow them
+    PODVector<Vector3> viewPositions_;
+    unsigned viewPositionsFrame_ = 0;
+    /// Static data of each tile in this frame, null for the tiles that are not animated
+    PODVector<const OceanTileData*> streamedTiles_;
+
+    /// Surface cache settings
+    bool surfaceCacheEnabled_ = false;
+    unsigned surfaceCacheResolution_ = 64;
+    float surfaceCacheCellSize_ = 1.f;
+    /// Nodes whose surroundings are cached besides the views
+    Vector<WeakPtr<Node> > surfaceCacheTargets_;
+    /// World x and z of the first sample of each grid of the cache
+    PODVector<Vector2> surfaceCacheOrigins_;
+    /// Height and world normal of the samples of all grids, row by row
+    PODVector<Vector4> surfaceCacheSamples_;
+    /// World height of the water plane at which the samples are queried
+    float surfaceCachePlaneHeight_ = 0.f;
+    /// Scratch list of the points of interest of this frame
+    PODVector<Vector3> pointsOfInterest_;
+
+    /// Only the time advances and the surface is evaluated for queries
+    bool serverMode_ = false;
+    /// Model to animate again when the server mode is disabled
+    SharedPtr<Model> serverModeModel_;
+    /// Waves and spectrum phases for queries, prepared by the first query after the time advanced
+    mutable PODVector<GerstnerWave> queryWaves_;
+    mutable PODVector<Vector2> querySpectrumPhases_;
+    mutable PODVector<unsigned> queryEmitters_;
+    mutable bool queryWavesDirty_ = true;
+
+    /// Temporal LOD settings
+    bool temporalLodEnabled_ = false;
+    float temporalLodFullRateSize_ = 0.5f;
+    unsigned temporalLodMaxInterval_ = 4;
+    /// Largest projected size of the last rendered frame and its frame number
+    float projectedSize_ = 0.f;
+    unsigned projectedSizeFrame_ = 0;
+    /// Ring of the previous, the next and the partially evaluated keyframe
+    Keyframe keyframes_[3];
+    /// Index of the previous keyframe in the ring
+    unsigned keyframeIndex_ = 0;
+    /// Number of evaluated vertices of the partially evaluated keyframe
+    unsigned keyframeProgress_ = 0;
+    /// Frames between the keyframes, 0 if the keyframes are not initialized
+    unsigned keyframeInterval_ = 0;
+    /// Keyframe ranges to evaluate in this frame
+    KeyframeTask keyframeTasks_[3];
+    /// Scratch list of the waves of a keyframe
+    PODVector<WaveSystem::Wave> keyframeWaves_;
+    unsigned numKeyframeTasks_ = 0;
+    /// Interpolation factor between the previous and the next keyframe in this frame
+    float keyframeFactor_ = 0.f;
+
+    /// Animated positions and normals of this frame, committed to the vertex buffer per tile
+    OceanVertexStreams animatedVertices_;
+    /// Tiles whose vertices changed in this frame
+    PODVector<unsigned char> changedTiles_;
+    /// Number of vertex ranges uploaded in the last animated frame
+    unsigned numUploadRanges_ = 0;
+    float uploadThreshold_ = 0.0001f;
+    unsigned maxUploadRanges_ = 8;
+    unsigned uploadedBytes_ = 0;
+    unsigned skippedBytes_ = 0;
+
+    /// Animation state of this frame, prepared on the main thread for AnimateRange
+    unsigned char* vertexData_ = nullptr;
+    unsigned vertexSize_ = 0;
+    unsigned normalOffset_ = 0;
+    bool animateKeyframes_ = false;
+    /// Normals are animated in this frame
+    bool animateNormals_ = true;
+    bool alwaysAnimateNormals_ = false;
+    /// Frame in which a view that shades the surface last rendered the ocean
+    unsigned normalsFrame_ = 0;
+    /// The last animated frame left the normals out, and a view needs them before it renders
+    bool normalsPending_ = false;
+    bool lateNormals_ = false;
+    /// Ocean whose surface this one renders in the current frame
+    WeakPtr<Ocean> surfaceSource_;
+    /// Commit the tiles even if their positions did not change
+    bool commitAllTiles_ = false;
+    PODVector<GerstnerWave> animationWaves_;
+    GerstnerKernel animationKernel_ = nullptr;
+    float animationWaveTime_ = 0.f;
+    PODVector<Vector2> spectrumPhases_;
+    unsigned spectrumHarmonics_ = 0;
+    /// Phases of the waves of the WaveSpectrum, kept in [0, 2 pi)
+    PODVector<float> spectrumPhaseAngles_;
+
+    /// The OceanManager that updates this ocean
+    WeakPtr<OceanManager> oceanManager_;
 
+    /// Time of the keyframes, the time the WaveSystem has after the update of the current frame
     float time_ = 0.0f;
+    /// Epoch of the WaveSystem that time_, the keyframe times and the wave times of the evaluation belong to
+    unsigned timeEpoch_ = 0;
 };
 
 }
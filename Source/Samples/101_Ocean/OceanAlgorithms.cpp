@@ -27,10 +27,154 @@
 
 #include "OceanAlgorithms.h"
 
+#include <cstring>
+
 
 namespace Urho3D
 {
 
+AlignedFloatArray::AlignedFloatArray(const AlignedFloatArray& rhs)
+{
+    *this = rhs;
+}
+
+AlignedFloatArray& AlignedFloatArray::operator =(const AlignedFloatArray& rhs)
+{
+    if (&rhs != this)
+    {
+        Resize(rhs.size_);
+        if (size_)
+            memcpy(buffer_, rhs.buffer_, size_ * sizeof(float));
+    }
+    return *this;
+}
+
+void AlignedFloatArray::Resize(const unsigned size)
+{
+    if (size > capacity_)
+    {
+        // Allocate one cache line more and start the floats at the first boundary, a whole number of lines is used so
+        // that no other data shares the last one
+        const unsigned capacity = (size * sizeof(float) + OCEAN_CACHE_LINE - 1) / OCEAN_CACHE_LINE * OCEAN_CACHE_LINE /
+            sizeof(float);
+        unsigned char* storage = new unsigned char[capacity * sizeof(float) + OCEAN_CACHE_LINE];
+        float* buffer = reinterpret_cast<float*>((reinterpret_cast<size_t>(storage) + OCEAN_CACHE_LINE - 1) &
+            ~static_cast<size_t>(OCEAN_CACHE_LINE - 1));
+        if (size_)
+            memcpy(buffer, buffer_, size_ * sizeof(float));
+        delete[] storage_;
+        storage_ = storage;
+        buffer_ = buffer;
+        capacity_ = capacity;
+    }
+    size_ = size;
+}
+
+void AlignedFloatArray::Release()
+{
+    delete[] storage_;
+    storage_ = nullptr;
+    buffer_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+}
+
+void OceanVertexStreams::Resize(const unsigned size)
+{
+    positionX_.Resize(size);
+    positionY_.Resize(size);
+    positionZ_.Resize(size);
+    normalX_.Resize(size);
+    normalY_.Resize(size);
+    normalZ_.Resize(size);
+}
+
+void OceanVertexStreams::Release()
+{
+    positionX_.Release();
+    positionY_.Release();
+    positionZ_.Release();
+    normalX_.Release();
+    normalY_.Release();
+    normalZ_.Release();
+}
+
+static inline void LerpStream(const AlignedFloatArray& from, const AlignedFloatArray& to, const float t, const unsigned begin,
+    const unsigned end, AlignedFloatArray& result)
+{
+    // Unit stride without aliasing between the streams, which the compiler vectorizes
+    const float* a = from.Buffer();
+    const float* b = to.Buffer();
+    float* r = result.Buffer();
+    for (unsigned j = begin; j < end; ++j)
+        r[j] = a[j] + (b[j] - a[j]) * t;
+}
+
+void LerpVertexStreams(const OceanVertexStreams& from, const OceanVertexStreams& to, const float t, const unsigned begin,
+    const unsigned end, OceanVertexStreams& result)
+{
+    LerpStream(from.positionX_, to.positionX_, t, begin, end, result.positionX_);
+    LerpStream(from.positionY_, to.positionY_, t, begin, end, result.positionY_);
+    LerpStream(from.positionZ_, to.positionZ_, t, begin, end, result.positionZ_);
+    LerpStream(from.normalX_, to.normalX_, t, begin, end, result.normalX_);
+    LerpStream(from.normalY_, to.normalY_, t, begin, end, result.normalY_);
+    LerpStream(from.normalZ_, to.normalZ_, t, begin, end, result.normalZ_);
+}
+
+void InterleaveVertexStreams(const OceanVertexStreams& streams, const unsigned begin, const unsigned end,
+    unsigned char* vertexData, const unsigned vertexSize, const unsigned normalOffset, const bool normals)
+{
+    const float* positionX = streams.positionX_.Buffer();
+    const float* positionY = streams.positionY_.Buffer();
+    const float* positionZ = streams.positionZ_.Buffer();
+    if (!normals)
+    {
+        for (unsigned j = begin; j < end; ++j)
+        {
+            float* position = reinterpret_cast<float*>(vertexData + j * vertexSize);
+            position[0] = positionX[j];
+            position[1] = positionY[j];
+            position[2] = positionZ[j];
+        }
+        return;
+    }
+
+    const float* normalX = streams.normalX_.Buffer();
+    const float* normalY = streams.normalY_.Buffer();
+    const float* normalZ = streams.normalZ_.Buffer();
+    for (unsigned j = begin; j < end; ++j)
+    {
+        float* position = reinterpret_cast<float*>(vertexData + j * vertexSize);
+        float* normal = reinterpret_cast<float*>(vertexData + j * vertexSize + normalOffset);
+        position[0] = positionX[j];
+        position[1] = positionY[j];
+        position[2] = positionZ[j];
+        normal[0] = normalX[j];
+        normal[1] = normalY[j];
+        normal[2] = normalZ[j];
+    }
+}
+
+float GetBoxDistance(const BoundingBox& box, const Vector3& point)
+{
+    const Vector3 closest(Clamp(point.x_, box.min_.x_, box.max_.x_), Clamp(point.y_, box.min_.y_, box.max_.y_),
+        Clamp(point.z_, box.min_.z_, box.max_.z_));
+    return (closest - point).Length();
+}
+
+Vector4 SampleGridBilinear(const Vector4* samples, const unsigned stride, const Vector2& position)
+{
+    // The last row and column interpolate within the cell before them
+    const unsigned x = Min(static_cast<unsigned>(position.x_), stride - 2);
+    const unsigned y = Min(static_cast<unsigned>(position.y_), stride - 2);
+    const float fx = position.x_ - x;
+    const float fy = position.y_ - y;
+    const Vector4* row = samples + y * stride + x;
+    const Vector4 top = row[0].Lerp(row[1], fx);
+    const Vector4 bottom = row[stride].Lerp(row[stride + 1], fx);
+    return top.Lerp(bottom, fy);
+}
+
 PODVector<Vector3> ExtractVertexPositions(VertexBuffer* vertexBuffer)
 {
     PODVector<Vector3> vertices{};
@@ -82,9 +226,79 @@ PODVector<unsigned> ExtractDuplicates(const PODVector<Vector3>& vertexPositions)
     return duplicates;
 }
 
-Vector3 CalculateGerstnerWavePosition(const Vector2 P, const float t, const float q, const float a, const Vector2& dir, const float w, const float phi)
+PODVector<OceanTile> ExtractTiles(const PODVector<Vector3>& vertexPositions)
+{
+    PODVector<OceanTile> tiles{};
+    for (unsigned begin = 0; begin < vertexPositions.Size(); begin += OCEAN_TILE_SIZE)
+    {
+        OceanTile tile;
+        tile.begin_ = begin;
+        tile.end_ = Min(begin + OCEAN_TILE_SIZE, vertexPositions.Size());
+        for (unsigned i = tile.begin_; i < tile.end_; ++i)
+            tile.bounds_.Merge(vertexPositions[i]);
+        tiles.Push(tile);
+    }
+    return tiles;
+}
+
+PODVector<OceanGridRow> ExtractGridRows(const PODVector<Vector3>& vertexPositions, const unsigned minLength)
+{
+    PODVector<OceanGridRow> rows{};
+    unsigned begin = 0;
+    while (begin + 1 < vertexPositions.Size())
+    {
+        const Vector2 origin(vertexPositions[begin].x_, vertexPositions[begin].z_);
+        const Vector2 step = Vector2(vertexPositions[begin + 1].x_, vertexPositions[begin + 1].z_) - origin;
+        const float tolerance = 1e-4f * step.Length();
+
+        // Compare with the position the row predicts, so that small errors do not add up along the row
+        unsigned end = begin + 1;
+        while (end < vertexPositions.Size() && step != Vector2::ZERO)
+        {
+            const Vector2 predicted = origin + step * static_cast<float>(end - begin);
+            const Vector2 position(vertexPositions[end].x_, vertexPositions[end].z_);
+            if ((position - predicted).Length() > tolerance)
+                break;
+            ++end;
+        }
+
+        if (end - begin >= minLength)
+        {
+            OceanGridRow row;
+            row.begin_ = begin;
+            row.end_ = end;
+            row.origin_ = origin;
+            row.step_ = step;
+            rows.Push(row);
+            begin = end;
+        }
+        else
+        {
+            ++begin;
+        }
+    }
+    return rows;
+}
+
+bool IsPeriodic(const Vector2& tileSize, const PODVector<WaveSystem::Wave>& waves, const float tolerance)
+{
+    for (const auto& wave : waves)
+    {
+        if (wave.l_ == 0.f)
+            continue;
+
+        // The phase changes by a whole number of crests across the tile
+        const float crestsX = wave.d_.x_ * tileSize.x_ / wave.l_;
+        const float crestsY = wave.d_.y_ * tileSize.y_ / wave.l_;
+        if (Abs(crestsX - RoundToInt(crestsX)) > tolerance || Abs(crestsY - RoundToInt(crestsY)) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+Vector3 CalculateGerstnerWavePosition(const Vector2 P, const float phase, const float q, const float a, const Vector2& dir, const float w)
 {
-    float inner = w * dir.DotProduct(P) + phi * t;
+    float inner = w * dir.DotProduct(P) + phase;
 
     float x = q * a * dir.x_ * cos(inner);
     float y = q * a * dir.y_ * cos(inner);
@@ -93,9 +307,9 @@ Vector3 CalculateGerstnerWavePosition(const Vector2 P, const float t, const floa
     return Vector3(x, y, z);
 }
 
-Vector3 CalculateGerstnerWaveNormal(const Vector2 P, const float t, const float q, const float a, const Vector2& dir, const float w, const float phi)
+Vector3 CalculateGerstnerWaveNormal(const Vector2 P, const float phase, const float q, const float a, const Vector2& dir, const float w)
 {
-    float inner = w * dir.DotProduct(P) + phi * t;
+    float inner = w * dir.DotProduct(P) + phase;
 
     float x = dir.x_ * w * a * cos(inner);
     float y = dir.y_ * w * a * cos(inner);
@@ -104,29 +318,405 @@ Vector3 CalculateGerstnerWaveNormal(const Vector2 P, const float t, const float
     return Vector3(x, y, z);
 };
 
-std::pair<Vector3, Vector3> CalculateGerstnerWaves(const Vector2 P, const float t, const PODVector<WaveSystem::Wave*>& waves)
+std::pair<Vector3, Vector3> CalculateGerstnerWaves(const Vector2 P, const PODVector<WaveSystem::Wave>& waves,
+    const float attenuation, const float phaseLag)
 {
     Vector3 medianWave{};
     Vector3 normal{};
     for (const auto& wave : waves)
     {
         float w = 0.f;
-        if (wave->l_ != 0.f)
-            w = 2.0f * M_PI / wave->l_;
+        if (wave.l_ != 0.f)
+            w = 2.0f * M_PI / wave.l_;
 
         float q = 0.f;
-        if (w != 0.f && wave->a_ != 0.f && waves.Size() != 0)
-            q = wave->q_ / (w * wave->a_ *  waves.Size());
+        if (w != 0.f && wave.a_ != 0.f && waves.Size() != 0)
+            q = wave.q_ / (w * wave.a_ *  waves.Size());
 
-        float phi = wave->s_ * w;
-        medianWave += CalculateGerstnerWavePosition(P, t, q, wave->a_, wave->d_, w, phi);
-        normal += CalculateGerstnerWaveNormal(P, t, q, wave->a_, wave->d_, w, phi);
+        const Vector2 lagged = P + wave.d_ * phaseLag;
+        medianWave += CalculateGerstnerWavePosition(lagged, wave.phase_, q, wave.a_, wave.d_, w);
+        normal += CalculateGerstnerWaveNormal(lagged, wave.phase_, q, wave.a_, wave.d_, w);
     }
+    medianWave *= attenuation;
+    normal *= attenuation;
 
     return std::pair<Vector3, Vector3>{
         Vector3(P.x_ + medianWave.x_, P.y_ + medianWave.y_, medianWave.z_),
             Vector3(-normal.x_, -normal.y_, 1 - normal.z_)
     };
 };
-        
+
+void PrepareGerstnerWaves(const PODVector<WaveSystem::Wave>& waves, PODVector<GerstnerWave>& result)
+{
+    // Same constants as CalculateGerstnerWaves
+    result.Resize(waves.Size());
+    for (unsigned i = 0; i < waves.Size(); ++i)
+    {
+        const WaveSystem::Wave& wave = waves[i];
+        GerstnerWave& constants = result[i];
+
+        float w = 0.f;
+        if (wave.l_ != 0.f)
+            w = 2.0f * M_PI / wave.l_;
+
+        float q = 0.f;
+        if (w != 0.f && wave.a_ != 0.f)
+            q = wave.q_ / (w * wave.a_ * waves.Size());
+
+        constants.d_ = wave.d_;
+        constants.w_ = w;
+        constants.phase_ = wave.phase_;
+        constants.a_ = wave.a_;
+        constants.qa_ = q * wave.a_;
+        constants.wa_ = w * wave.a_;
+        constants.qwa_ = q * w * wave.a_;
+    }
+}
+
+/// Phases beyond this magnitude are wrapped into one period before the reduction, which is exact only below it
+static const float WAVE_PHASE_REDUCTION_LIMIT = 1.0e4f;
+
+/// Evaluates the sine and cosine of x in radians. The polynomials approximate them on [-pi/4, pi/4] after the
+/// quadrant has been removed, pi/2 is split into two parts so that the reduction stays exact for large x
+template <WavePrecision precision> static inline void WaveSinCos(const float x, float& s, float& c)
+{
+    if (precision == WAVE_PRECISION_EXACT)
+    {
+        s = sin(x);
+        c = cos(x);
+        return;
+    }
+
+    // The branch is not taken by the phases of the kernels, which stay within a few hundred radians
+    const float phase = Abs(x) <= WAVE_PHASE_REDUCTION_LIMIT ? x : fmodf(x, 2.f * M_PI);
+    const float k = floorf(phase * (2.f / M_PI) + 0.5f);
+    const float r = (phase - k * 1.5703125f) - k * 4.83826794897e-4f;
+    const float r2 = r * r;
+
+    float sinR;
+    float cosR;
+    if (precision == WAVE_PRECISION_HIGH)
+    {
+        sinR = r * (1.f + r2 * (-1.f / 6.f + r2 * (1.f / 120.f + r2 * (-1.f / 5040.f))));
+        cosR = 1.f + r2 * (-0.5f + r2 * (1.f / 24.f + r2 * (-1.f / 720.f + r2 * (1.f / 40320.f))));
+    }
+    else
+    {
+        sinR = r * (1.f + r2 * (-1.f / 6.f + r2 * (1.f / 120.f)));
+        cosR = 1.f + r2 * (-0.5f + r2 * (1.f / 24.f + r2 * (-1.f / 720.f)));
+    }
+
+    // The quadrant is taken in float, a phase that is not finite must not reach a conversion to int
+    const float quadrant = k - 4.f * floorf(k * 0.25f);
+    if (quadrant == 0.f)
+    {
+        s = sinR;
+        c = cosR;
+    }
+    else if (quadrant == 1.f)
+    {
+        s = cosR;
+        c = -sinR;
+    }
+    else if (quadrant == 2.f)
+    {
+        s = -sinR;
+        c = -cosR;
+    }
+    else
+    {
+        s = -cosR;
+        c = sinR;
+    }
+}
+
+void CalculateWaveSinCos(const float x, const WavePrecision precision, float& s, float& c)
+{
+    switch (precision)
+    {
+    case WAVE_PRECISION_HIGH:
+        WaveSinCos<WAVE_PRECISION_HIGH>(x, s, c);
+        break;
+    case WAVE_PRECISION_FAST:
+        WaveSinCos<WAVE_PRECISION_FAST>(x, s, c);
+        break;
+    default:
+        WaveSinCos<WAVE_PRECISION_EXACT>(x, s, c);
+        break;
+    }
+}
+
+/// Adds N waves to the displacement and, if normals is set, to the slope. N is known at compile time, so that the loop
+/// is unrolled
+template <unsigned N, WavePrecision precision, bool normals> static inline void AddGerstnerWaves(const Vector2 P,
+    const GerstnerWave* waves, const float phaseLag, Vector3& displacement, Vector3& slope)
+{
+    for (unsigned i = 0; i < N; ++i)
+    {
+        const GerstnerWave& wave = waves[i];
+        const float inner = wave.w_ * wave.d_.DotProduct(P + wave.d_ * phaseLag) + wave.phase_;
+        float s;
+        float c;
+        WaveSinCos<precision>(inner, s, c);
+        displacement += Vector3(wave.qa_ * wave.d_.x_ * c, wave.qa_ * wave.d_.y_ * c, wave.a_ * s);
+        if (normals)
+            slope += Vector3(wave.wa_ * wave.d_.x_ * c, wave.wa_ * wave.d_.y_ * c, wave.qwa_ * s);
+    }
+}
+
+/// Returns the vertex position and normal for the summed displacement and slope
+static inline PositionAndNormal GetPositionAndNormal(const Vector2 P, const Vector3& displacement, const Vector3& slope,
+    const float attenuation)
+{
+    return PositionAndNormal{
+        Vector3(P.x_ + attenuation * displacement.x_, P.y_ + attenuation * displacement.y_, attenuation * displacement.z_),
+        Vector3(-attenuation * slope.x_, -attenuation * slope.y_, 1 - attenuation * slope.z_)
+    };
+}
+
+/// Kernel for a fixed wave count
+template <unsigned N, WavePrecision precision, bool normals> static PositionAndNormal GerstnerKernelFixed(const Vector2 P,
+    const GerstnerWave* waves, const unsigned numWaves, const float attenuation, const float phaseLag)
+{
+    Vector3 displacement{};
+    Vector3 slope{};
+    AddGerstnerWaves<N, precision, normals>(P, waves, phaseLag, displacement, slope);
+    return GetPositionAndNormal(P, displacement, slope, attenuation);
+}
+
+/// Kernel for any other wave count, processes four waves per iteration
+template <WavePrecision precision, bool normals> static PositionAndNormal GerstnerKernelGeneric(const Vector2 P,
+    const GerstnerWave* waves, const unsigned numWaves, const float attenuation, const float phaseLag)
+{
+    Vector3 displacement{};
+    Vector3 slope{};
+    unsigned i = 0;
+    for (; i + 4 <= numWaves; i += 4)
+        AddGerstnerWaves<4, precision, normals>(P, waves + i, phaseLag, displacement, slope);
+    for (; i < numWaves; ++i)
+        AddGerstnerWaves<1, precision, normals>(P, waves + i, phaseLag, displacement, slope);
+    return GetPositionAndNormal(P, displacement, slope, attenuation);
+}
+
+/// Dispatch table of the kernels of one precision
+template <WavePrecision precision, bool normals> static GerstnerKernel GetGerstnerKernel(const unsigned numWaves)
+{
+    static const GerstnerKernel kernels[] =
+    {
+        GerstnerKernelFixed<0, precision, normals>, GerstnerKernelFixed<1, precision, normals>,
+        GerstnerKernelFixed<2, precision, normals>, GerstnerKernelFixed<3, precision, normals>,
+        GerstnerKernelFixed<4, precision, normals>, GerstnerKernelFixed<5, precision, normals>,
+        GerstnerKernelFixed<6, precision, normals>, GerstnerKernelFixed<7, precision, normals>,
+        GerstnerKernelFixed<8, precision, normals>, GerstnerKernelFixed<9, precision, normals>,
+        GerstnerKernelFixed<10, precision, normals>, GerstnerKernelFixed<11, precision, normals>,
+        GerstnerKernelFixed<12, precision, normals>, GerstnerKernelFixed<13, precision, normals>,
+        GerstnerKernelFixed<14, precision, normals>, GerstnerKernelFixed<15, precision, normals>,
+        GerstnerKernelFixed<16, precision, normals>
+    };
+    static const unsigned numKernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    if (numWaves < numKernels)
+        return kernels[numWaves];
+
+    switch (numWaves)
+    {
+    case 20:
+        return GerstnerKernelFixed<20, precision, normals>;
+    case 24:
+        return GerstnerKernelFixed<24, precision, normals>;
+    case 28:
+        return GerstnerKernelFixed<28, precision, normals>;
+    case 32:
+        return GerstnerKernelFixed<32, precision, normals>;
+    default:
+        return GerstnerKernelGeneric<precision, normals>;
+    }
+}
+
+/// Kernels of one precision with or without the normals
+template <WavePrecision precision> static GerstnerKernel GetGerstnerKernel(const unsigned numWaves, const bool normals)
+{
+    return normals ? GetGerstnerKernel<precision, true>(numWaves) : GetGerstnerKernel<precision, false>(numWaves);
+}
+
+GerstnerKernel GetGerstnerKernel(const unsigned numWaves, const WavePrecision precision, const bool normals)
+{
+    switch (precision)
+    {
+    case WAVE_PRECISION_HIGH:
+        return GetGerstnerKernel<WAVE_PRECISION_HIGH>(numWaves, normals);
+    case WAVE_PRECISION_FAST:
+        return GetGerstnerKernel<WAVE_PRECISION_FAST>(numWaves, normals);
+    default:
+        return GetGerstnerKernel<WAVE_PRECISION_EXACT>(numWaves, normals);
+    }
+}
+
+/// Calculates the Gerstner waves along a grid row, with the slopes only if normals is set
+template <bool normals> static void CalculateGerstnerWavesAlongRow(const Vector2 origin, const Vector2 step,
+    const unsigned count, const GerstnerWave* waves, const unsigned numWaves, PositionAndNormal* results)
+{
+    Vector3 displacements[OCEAN_ROW_RESEED];
+    Vector3 slopes[OCEAN_ROW_RESEED];
+    for (unsigned blockBegin = 0; blockBegin < count; blockBegin += OCEAN_ROW_RESEED)
+    {
+        const unsigned blockSize = Min(count - blockBegin, OCEAN_ROW_RESEED);
+        const Vector2 blockOrigin = origin + step * static_cast<float>(blockBegin);
+        for (unsigned i = 0; i < blockSize; ++i)
+        {
+            displacements[i] = Vector3::ZERO;
+            slopes[i] = Vector3::ZERO;
+        }
+
+        for (unsigned j = 0; j < numWaves; ++j)
+        {
+            const GerstnerWave& wave = waves[j];
+
+            // Exact phase at the start of the block and the rotation from one vertex to the next
+            const float inner = wave.w_ * wave.d_.DotProduct(blockOrigin) + wave.phase_;
+            const float delta = wave.w_ * wave.d_.DotProduct(step);
+            float s = sin(inner);
+            float c = cos(inner);
+            const float sinDelta = sin(delta);
+            const float cosDelta = cos(delta);
+
+            const Vector2 horizontal = wave.d_ * wave.qa_;
+            const Vector2 horizontalSlope = wave.d_ * wave.wa_;
+            for (unsigned i = 0; i < blockSize; ++i)
+            {
+                displacements[i] += Vector3(horizontal.x_ * c, horizontal.y_ * c, wave.a_ * s);
+                if (normals)
+                    slopes[i] += Vector3(horizontalSlope.x_ * c, horizontalSlope.y_ * c, wave.qwa_ * s);
+
+                const float nextSin = s * cosDelta + c * sinDelta;
+                c = c * cosDelta - s * sinDelta;
+                s = nextSin;
+            }
+        }
+
+        for (unsigned i = 0; i < blockSize; ++i)
+        {
+            const Vector2 P = blockOrigin + step * static_cast<float>(i);
+            results[blockBegin + i] = GetPositionAndNormal(P, displacements[i], slopes[i], 1.f);
+        }
+    }
+}
+
+void CalculateGerstnerWavesAlongRow(const Vector2 origin, const Vector2 step, const unsigned count, const GerstnerWave* waves,
+    const unsigned numWaves, PositionAndNormal* results, const bool normals)
+{
+    if (normals)
+        CalculateGerstnerWavesAlongRow<true>(origin, step, count, waves, numWaves, results);
+    else
+        CalculateGerstnerWavesAlongRow<false>(origin, step, count, waves, numWaves, results);
+}
+
+/// Adds the waves of a spectrum, with the slopes only if normals is set
+template <bool normals> static void AddSpectrumWaves(const Vector2 P, const WaveSpectrum& spectrum,
+    const PODVector<Vector2>& phases, const unsigned maxHarmonics, const float attenuation, const float phaseLag,
+    PositionAndNormal& wave)
+{
+    const PODVector<WaveSpectrum::Harmonic>& harmonics = spectrum.GetHarmonics();
+    Vector3 displacement{};
+    Vector3 slope{};
+    for (const auto& band : spectrum.GetBands())
+    {
+        // One cosine and sine per band, the harmonics follow from cos(nx) = 2 cos(x) cos((n-1)x) - cos((n-2)x)
+        // and the same recurrence for the sine
+        const float x = band.w_ * (band.d_.DotProduct(P) + phaseLag);
+        const float cosX = cos(x);
+        float cosN = cosX;
+        float sinN = sin(x);
+        float cosPrevious = 1.f;
+        float sinPrevious = 0.f;
+
+        // All waves of a band share the direction, so it is applied to the sums
+        float horizontal = 0.f;
+        float height = 0.f;
+        float horizontalSlope = 0.f;
+        float verticalSlope = 0.f;
+        const unsigned end = Min(band.end_, band.begin_ + maxHarmonics);
+        for (unsigned i = band.begin_; i < end; ++i)
+        {
+            // Add the time dependent phase of the wave
+            const WaveSpectrum::Harmonic& harmonic = harmonics[i];
+            const Vector2& phase = phases[i];
+            const float c = cosN * phase.x_ - sinN * phase.y_;
+            const float s = sinN * phase.x_ + cosN * phase.y_;
+            horizontal += harmonic.qa_ * c;
+            height += harmonic.a_ * s;
+            if (normals)
+            {
+                horizontalSlope += harmonic.wa_ * c;
+                verticalSlope += harmonic.qwa_ * s;
+            }
+
+            const float cosNext = 2.f * cosX * cosN - cosPrevious;
+            const float sinNext = 2.f * cosX * sinN - sinPrevious;
+            cosPrevious = cosN;
+            sinPrevious = sinN;
+            cosN = cosNext;
+            sinN = sinNext;
+        }
+
+        displacement += Vector3(band.d_.x_ * horizontal, band.d_.y_ * horizontal, height);
+        slope += Vector3(band.d_.x_ * horizontalSlope, band.d_.y_ * horizontalSlope, verticalSlope);
+    }
+
+    wave.first += displacement * attenuation;
+    wave.second -= slope * attenuation;
+}
+
+void AddSpectrumWaves(const Vector2 P, const WaveSpectrum& spectrum, const PODVector<Vector2>& phases,
+    const unsigned maxHarmonics, const float attenuation, const float phaseLag, PositionAndNormal& wave, const bool normals)
+{
+    if (normals)
+        AddSpectrumWaves<true>(P, spectrum, phases, maxHarmonics, attenuation, phaseLag, wave);
+    else
+        AddSpectrumWaves<false>(P, spectrum, phases, maxHarmonics, attenuation, phaseLag, wave);
+}
+
+Vector3 CalculateEmitterWave(const Vector2 P, const float t, const WaveSystem::Emitter& emitter)
+{
+    const Vector2 offset = P - emitter.position_;
+    const float distanceSquared = offset.LengthSquared();
+    if (t < emitter.startTime_ || t >= emitter.endTime_ || distanceSquared >= emitter.radius_ * emitter.radius_)
+        return Vector3::ZERO;
+
+    // The amplitude falls off towards the radius and decays linearly over the lifetime
+    const float distance = sqrtf(distanceSquared);
+    const float falloff = 1.f - distance / emitter.radius_;
+    const float age = t - emitter.startTime_;
+    const float decay = emitter.endTime_ < M_INFINITY ? 1.f - age / (emitter.endTime_ - emitter.startTime_) : 1.f;
+    const float w = 2.0f * M_PI / emitter.length_;
+
+    // The slope of the envelope is small compared to the slope of the crests and is neglected
+    if (emitter.type_ == WaveSystem::EMITTER_RIPPLE)
+    {
+        // Ring that spreads from the position, it rises over one length behind its front
+        const float front = emitter.speed_ * age;
+        if (distance >= front || distance == 0.f)
+            return Vector3::ZERO;
+
+        const float a = emitter.amplitude_ * falloff * falloff * decay * Min((front - distance) / emitter.length_, 1.f);
+        const float inner = w * (distance - front);
+        const Vector2 slope = offset * (a * w * cos(inner) / distance);
+        return Vector3(slope.x_, slope.y_, a * sin(inner));
+    }
+
+    // Approximation of a Kelvin wake: crests across the track inside a wedge with a half angle of 19.47 degrees,
+    // strongest at the edges of the wedge
+    const float behind = -offset.DotProduct(emitter.direction_);
+    const float side = Abs(offset.x_ * emitter.direction_.y_ - offset.y_ * emitter.direction_.x_);
+    const float wedge = behind * 0.3536f;
+    if (behind <= 0.f || side >= wedge)
+        return Vector3::ZERO;
+
+    const float edge = side / wedge;
+    const float a = emitter.amplitude_ * falloff * decay * (0.5f + 0.5f * edge * edge) * Min((wedge - side) / emitter.length_, 1.f);
+    const float inner = w * behind;
+    const Vector2 slope = emitter.direction_ * (-a * w * cos(inner));
+    return Vector3(slope.x_, slope.y_, a * sin(inner));
+}
+
 }
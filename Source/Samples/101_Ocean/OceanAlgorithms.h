@@ -23,8 +23,11 @@
 #pragma once
 
 #include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/BoundingBox.h>
 #include <Urho3D/Math/Vector3.h>
+#include <Urho3D/Math/Vector4.h>
 
+#include "WaveSpectrum.h"
 #include "WaveSystem.h"
 
 #include <tuple>
@@ -37,18 +40,197 @@ class VertexBuffer;
 
 using PositionAndNormal = std::pair<Vector3, Vector3>;
 
+/// Number of consecutive vertices that form a tile
+static const unsigned OCEAN_TILE_SIZE = 1024;
+
+/// A range of consecutive vertices and the bounds of their rest positions
+struct OceanTile
+{
+    unsigned begin_;
+    unsigned end_;
+    BoundingBox bounds_;
+};
+
+/// Number of vertices of a grid row after which the trigonometric recurrence is seeded with exact values again
+static const unsigned OCEAN_ROW_RESEED = 32;
+
+/// A run of consecutive vertices whose x and z positions advance by a constant step, e.g. a row of a regular grid
+struct OceanGridRow
+{
+    unsigned begin_;
+    unsigned end_;
+    /// Position of the first vertex in the plane of the waves
+    Vector2 origin_;
+    /// Distance between two vertices in the plane of the waves
+    Vector2 step_;
+};
+
+/// Size of a cache line, the alignment of the working data of the ocean
+static const unsigned OCEAN_CACHE_LINE = 64;
+
+/// Array of floats that starts on a cache line. The working data of the ocean is kept as a structure of such arrays, so
+/// every loaded cache line only holds values that the loop needs
+class AlignedFloatArray
+{
+public:
+    AlignedFloatArray() = default;
+    AlignedFloatArray(const AlignedFloatArray& rhs);
+    ~AlignedFloatArray() { delete[] storage_; }
+
+    AlignedFloatArray& operator =(const AlignedFloatArray& rhs);
+    float& operator [](const unsigned index) { return buffer_[index]; }
+    const float& operator [](const unsigned index) const { return buffer_[index]; }
+
+    /// Resize the array, keeping the values that fit
+    void Resize(const unsigned size);
+    /// Set the size to zero and release the storage
+    void Release();
+    unsigned Size() const { return size_; }
+    bool Empty() const { return size_ == 0; }
+    float* Buffer() { return buffer_; }
+    const float* Buffer() const { return buffer_; }
+
+private:
+    unsigned char* storage_ = nullptr;
+    float* buffer_ = nullptr;
+    unsigned size_ = 0;
+    unsigned capacity_ = 0;
+};
+
+/// Positions and normals of the vertices of an ocean as a structure of arrays
+struct OceanVertexStreams
+{
+    /// Resize all streams, keeping the values that fit
+    void Resize(const unsigned size);
+    /// Release the storage of all streams
+    void Release();
+    unsigned Size() const { return positionX_.Size(); }
+
+    /// Store the position and the normal of a vertex
+    void Set(const unsigned index, const PositionAndNormal& vertex)
+    {
+        positionX_[index] = vertex.first.x_;
+        positionY_[index] = vertex.first.y_;
+        positionZ_[index] = vertex.first.z_;
+        normalX_[index] = vertex.second.x_;
+        normalY_[index] = vertex.second.y_;
+        normalZ_[index] = vertex.second.z_;
+    }
+    /// Store the position of a vertex and keep its normal
+    void SetPosition(const unsigned index, const Vector3& position)
+    {
+        positionX_[index] = position.x_;
+        positionY_[index] = position.y_;
+        positionZ_[index] = position.z_;
+    }
+    /// Returns the position and the normal of a vertex
+    PositionAndNormal Get(const unsigned index) const
+    {
+        return PositionAndNormal(Vector3(positionX_[index], positionY_[index], positionZ_[index]),
+            Vector3(normalX_[index], normalY_[index], normalZ_[index]));
+    }
+
+    AlignedFloatArray positionX_;
+    AlignedFloatArray positionY_;
+    AlignedFloatArray positionZ_;
+    AlignedFloatArray normalX_;
+    AlignedFloatArray normalY_;
+    AlignedFloatArray normalZ_;
+};
+
+/// Interpolate the vertices between begin and end of two vertex streams linearly into result
+void LerpVertexStreams(const OceanVertexStreams& from, const OceanVertexStreams& to, const float t, const unsigned begin,
+    const unsigned end, OceanVertexStreams& result);
+/// Interleave the positions and, if normals is set, the normals of the vertices between begin and end into vertex data
+void InterleaveVertexStreams(const OceanVertexStreams& streams, const unsigned begin, const unsigned end,
+    unsigned char* vertexData, const unsigned vertexSize, const unsigned normalOffset, const bool normals = true);
+
+/// Returns the distance from a point to the closest point of a box, 0 inside
+float GetBoxDistance(const BoundingBox& box, const Vector3& point);
+/// Interpolate bilinearly between the samples of a grid with stride samples per row. position is given in cells and
+/// must lie within the grid
+Vector4 SampleGridBilinear(const Vector4* samples, const unsigned stride, const Vector2& position);
+
 /// Extract the Vertex positions from a VertexBuffer
 PODVector<Vector3> ExtractVertexPositions(VertexBuffer* vertexBuffer);
 /// Extract duplicated vertices from a list of vertices
 PODVector<unsigned> ExtractDuplicates(const PODVector<Vector3>& vertexPositions);
+/// Split a list of vertices into tiles of OCEAN_TILE_SIZE vertices
+PODVector<OceanTile> ExtractTiles(const PODVector<Vector3>& vertexPositions);
+/// Find the grid rows of at least minLength vertices in a list of vertices
+PODVector<OceanGridRow> ExtractGridRows(const PODVector<Vector3>& vertexPositions, const unsigned minLength = 8);
+
+/// Returns true if every wave repeats over the tile size along both axes, within a tolerance given in crests
+bool IsPeriodic(const Vector2& tileSize, const PODVector<WaveSystem::Wave>& waves, const float tolerance = 0.01f);
+
+/// Calculate the new vertex position by applying the Gerstner Wave function with the time dependent phase
+Vector3 CalculateGerstnerWavePosition(const Vector2 P, const float phase, const float q, const float a,
+    const Vector2& dir, const float w);
+/// Calculate the new vertex normal by applying the Gerstner Wave function with the time dependent phase
+Vector3 CalculateGerstnerWaveNormal(const Vector2 P, const float phase, const float q, const float a,
+    const Vector2& dir, const float w);
+/// Calculate the sum of all Gerstner waves at their current phases and return the new vertex position and normal. The
+/// displacement is scaled by attenuation and the crests lag behind by phaseLag along their direction, e.g. in shallow water
+PositionAndNormal CalculateGerstnerWaves(const Vector2 P, const PODVector<WaveSystem::Wave>& waves,
+    const float attenuation = 1.f, const float phaseLag = 0.f);
+/// Precision of the sine and cosine in the Gerstner kernels
+enum WavePrecision
+{
+    /// Standard library sin and cos
+    WAVE_PRECISION_EXACT = 0,
+    /// Polynomial, the maximum absolute error against sin and cos is 4.5e-7 for phases up to 1e4 radians
+    WAVE_PRECISION_HIGH,
+    /// Shorter polynomial, the maximum absolute error is 3.7e-5
+    WAVE_PRECISION_FAST
+};
+
+/// Calculate the sine and cosine of a phase in radians with the precision of the Gerstner kernels. Phases beyond 1e4
+/// radians are wrapped into one period first, where float holds them too coarsely for the stated errors
+void CalculateWaveSinCos(const float x, const WavePrecision precision, float& s, float& c);
+
+/// Constants of a Gerstner wave at one point in time, shared by all vertices
+struct GerstnerWave
+{
+    /// The movement direction
+    Vector2 d_;
+    /// Frequency, 2 pi divided by the length
+    float w_;
+    /// Time dependent phase of the Wave, within [0, 2 pi)
+    float phase_;
+    /// Amplitude
+    float a_;
+    /// Steepness times amplitude
+    float qa_;
+    /// Frequency times amplitude
+    float wa_;
+    /// Steepness times frequency times amplitude
+    float qwa_;
+};
+
+/// Kernel that sums numWaves Gerstner waves at P and returns the new vertex position and normal, see CalculateGerstnerWaves
+typedef PositionAndNormal (*GerstnerKernel)(const Vector2 P, const GerstnerWave* waves, const unsigned numWaves,
+    const float attenuation, const float phaseLag);
+
+/// Calculate the constants of the waves at their current phases
+void PrepareGerstnerWaves(const PODVector<WaveSystem::Wave>& waves, PODVector<GerstnerWave>& result);
+/// Returns a kernel that is specialized for the wave count and the precision. The wave counts 0 to 16 and multiples
+/// of 4 up to 32 have their own. Without normals the kernel skips the slopes and returns the normal of the flat plane
+GerstnerKernel GetGerstnerKernel(const unsigned numWaves, const WavePrecision precision = WAVE_PRECISION_EXACT,
+    const bool normals = true);
+
+/// Calculate the Gerstner waves for count vertices along a grid row, starting at origin. Instead of a sine and cosine per
+/// wave and vertex, the phases are advanced by a rotation and seeded again every OCEAN_ROW_RESEED vertices. Without
+/// normals the slopes are skipped
+void CalculateGerstnerWavesAlongRow(const Vector2 origin, const Vector2 step, const unsigned count, const GerstnerWave* waves,
+    const unsigned numWaves, PositionAndNormal* results, const bool normals = true);
 
-/// Calculate the new vertex position by applying the Gerstner Wave function
-Vector3 CalculateGerstnerWavePosition(const Vector2 P, const float t, const float q, const float a,
-    const Vector2& dir, const float w, const float phi);
-/// Calculate the new vertex normal by applying the Gerstner Wave function
-Vector3 CalculateGerstnerWaveNormal(const Vector2 P, const float t, const float q, const float a,
-    const Vector2& dir, const float w, const float phi);
-/// Calculate the sum of all Gerstner waves and return the new vertex position and normal
-PositionAndNormal CalculateGerstnerWaves(const Vector2 P, const float t, const PODVector<WaveSystem::Wave*>& waves);
+/// Add the waves of a spectrum to a result of CalculateGerstnerWaves. phases holds the cosine and sine of the time
+/// dependent phase of each wave, only the first maxHarmonics waves of each band are evaluated. The normal is left as it
+/// is without normals
+void AddSpectrumWaves(const Vector2 P, const WaveSpectrum& spectrum, const PODVector<Vector2>& phases,
+    const unsigned maxHarmonics, const float attenuation, const float phaseLag, PositionAndNormal& wave,
+    const bool normals = true);
+/// Calculate the height of a local emitter in z and its slope along x and y
+Vector3 CalculateEmitterWave(const Vector2 P, const float t, const WaveSystem::Emitter& emitter);
 
 }
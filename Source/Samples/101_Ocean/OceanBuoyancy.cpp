@@ -0,0 +1,255 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+#include "Urho3D/Core/Context.h"
+#include "Urho3D/IO/Log.h"
+#ifdef URHO3D_PHYSICS
+#include "Urho3D/Physics/CollisionShape.h"
+#include "Urho3D/Physics/RigidBody.h"
+#endif
+#include "Urho3D/Scene/Scene.h"
+
+#include "Ocean.h"
+#include "OceanBuoyancy.h"
+#include "OceanManager.h"
+
+
+#ifdef URHO3D_PHYSICS
+
+namespace Urho3D
+{
+
+extern const char* PHYSICS_CATEGORY;
+
+OceanBuoyancy::OceanBuoyancy(Context* context) :
+    Component(context)
+{
+}
+
+OceanBuoyancy::~OceanBuoyancy()
+{
+}
+
+void OceanBuoyancy::RegisterObject(Context* context)
+{
+    context->RegisterFactory<OceanBuoyancy>(PHYSICS_CATEGORY);
+}
+
+void OceanBuoyancy::SetOcean(Ocean* ocean)
+{
+    ocean_ = ocean;
+}
+
+bool OceanBuoyancy::BeginStep(Ocean* defaultOcean, const Vector3& gravity)
+{
+    body_ = nullptr;
+    stepOcean_ = nullptr;
+    submergedVolume_ = 0.f;
+    force_ = Vector3::ZERO;
+    torque_ = Vector3::ZERO;
+
+    Ocean* ocean = ocean_ ? ocean_.Get() : defaultOcean;
+    RigidBody* body = node_ ? node_->GetComponent<RigidBody>() : nullptr;
+    CollisionShape* shape = node_ ? node_->GetComponent<CollisionShape>() : nullptr;
+    if (!IsEnabledEffective() || !ocean || !ocean->IsEnabledEffective() || !body || !body->IsEnabledEffective() ||
+        body->GetMass() <= 0.f || !shape)
+        return false;
+
+    // Everything the columns need is copied here, the workers must not touch the physics objects
+    body_ = body;
+    stepOcean_ = ocean;
+    shapeType_ = shape->GetShapeType();
+    shapeTransform_ = node_->GetWorldTransform() * Matrix3x4(shape->GetPosition(), shape->GetRotation(), Vector3::ONE);
+    const Vector3& size = shape->GetSize();
+    switch (shapeType_)
+    {
+    case SHAPE_BOX:
+        halfSize_ = size * 0.5f;
+        break;
+
+    // The diameter of the round shapes is their x size, capsules and cylinders have their height along y
+    case SHAPE_SPHERE:
+        halfSize_ = Vector3::ONE * (size.x_ * 0.5f);
+        break;
+
+    case SHAPE_CAPSULE:
+        halfSize_ = Vector3(size.x_, Max(size.x_, size.y_), size.x_) * 0.5f;
+        break;
+
+    case SHAPE_CYLINDER:
+        halfSize_ = Vector3(size.x_, size.y_, size.x_) * 0.5f;
+        break;
+
+    default:
+        {
+            if (!shapeWarningShown_)
+            {
+                URHO3D_LOGWARNINGF("OceanBuoyancy of node %s approximates a shape of type %d by its world bounding box",
+                    node_->GetName().CString(), shapeType_);
+                shapeWarningShown_ = true;
+            }
+            const BoundingBox box = shape->GetWorldBoundingBox();
+            shapeTransform_ = Matrix3x4(box.Center(), Quaternion::IDENTITY, Vector3::ONE);
+            halfSize_ = box.HalfSize();
+            shapeType_ = SHAPE_BOX;
+        }
+        break;
+    }
+
+    // The columns sample the height of the shape at their centers, they share its exact volume in proportion to it
+    const float radius = halfSize_.x_;
+    float volume = 8.f * halfSize_.x_ * halfSize_.y_ * halfSize_.z_;
+    if (shapeType_ == SHAPE_SPHERE)
+        volume = 4.f / 3.f * M_PI * radius * radius * radius;
+    else if (shapeType_ == SHAPE_CYLINDER)
+        volume = M_PI * radius * radius * 2.f * halfSize_.y_;
+    else if (shapeType_ == SHAPE_CAPSULE)
+        volume = M_PI * radius * radius * (2.f * halfSize_.y_ - 2.f / 3.f * radius);
+    const Vector3 scale = shapeTransform_.Scale();
+    shapeVolume_ = volume * scale.x_ * scale.y_ * scale.z_;
+
+    const unsigned resolution = sampleResolution_;
+    const Vector2 cellSize(2.f * halfSize_.x_ / resolution, 2.f * halfSize_.z_ / resolution);
+    float columnHeights = 0.f;
+    for (unsigned z = 0; z < resolution; ++z)
+    {
+        for (unsigned x = 0; x < resolution; ++x)
+        {
+            columnHeights += 2.f * GetColumnHalfHeight(-halfSize_.x_ + (x + 0.5f) * cellSize.x_,
+                -halfSize_.z_ + (z + 0.5f) * cellSize.y_);
+        }
+    }
+    if (columnHeights <= 0.f)
+        return false;
+    volumePerHeight_ = shapeVolume_ / columnHeights;
+
+    centerOfMass_ = body->GetPosition() + body->GetRotation() * body->GetCenterOfMass();
+    linearVelocity_ = body->GetLinearVelocity();
+    angularVelocity_ = body->GetAngularVelocity();
+    gravity_ = gravity;
+    return shapeVolume_ > 0.f;
+}
+
+void OceanBuoyancy::EvaluateStep(unsigned* emitters)
+{
+    if (!stepOcean_)
+        return;
+
+    const unsigned resolution = sampleResolution_;
+    const float columnShare = 1.f / (resolution * resolution);
+    const Vector2 cellSize(2.f * halfSize_.x_ / resolution, 2.f * halfSize_.z_ / resolution);
+
+    Vector3 force;
+    Vector3 torque;
+    float submergedVolume = 0.f;
+    for (unsigned z = 0; z < resolution; ++z)
+    {
+        for (unsigned x = 0; x < resolution; ++x)
+        {
+            // The column runs along the up axis of the shape, whichever of its ends lies lower is submerged first
+            const float localX = -halfSize_.x_ + (x + 0.5f) * cellSize.x_;
+            const float localZ = -halfSize_.z_ + (z + 0.5f) * cellSize.y_;
+            const float halfHeight = GetColumnHalfHeight(localX, localZ);
+            if (halfHeight <= 0.f)
+                continue;
+            Vector3 low = shapeTransform_ * Vector3(localX, -halfHeight, localZ);
+            Vector3 high = shapeTransform_ * Vector3(localX, halfHeight, localZ);
+            if (low.y_ > high.y_)
+                Swap(low, high);
+
+            const float surfaceHeight = stepOcean_->EvaluateSurface((low + high) * 0.5f, emitters, queryIterations_).first.y_;
+            const float columnHeight = high.y_ - low.y_;
+            const float fraction = columnHeight > M_EPSILON ? Clamp((surfaceHeight - low.y_) / columnHeight, 0.f, 1.f) :
+                (surfaceHeight > low.y_ ? 1.f : 0.f);
+            if (fraction <= 0.f)
+                continue;
+
+            // Buoyancy acts at the center of the submerged part, the drag at the same point against its velocity
+            const Vector3 center = low.Lerp(high, fraction * 0.5f);
+            const Vector3 arm = center - centerOfMass_;
+            const Vector3 pointVelocity = linearVelocity_ + angularVelocity_.CrossProduct(arm);
+            const float volume = volumePerHeight_ * 2.f * halfHeight * fraction;
+            const Vector3 columnForce = -gravity_ * (density_ * volume) - pointVelocity * (linearDrag_ * columnShare * fraction);
+
+            submergedVolume += volume;
+            force += columnForce;
+            torque += arm.CrossProduct(columnForce);
+        }
+    }
+
+    torque -= angularVelocity_ * (angularDrag_ * submergedVolume / shapeVolume_);
+
+    submergedVolume_ = submergedVolume;
+    force_ = force;
+    torque_ = torque;
+}
+
+float OceanBuoyancy::GetColumnHalfHeight(const float localX, const float localZ) const
+{
+    if (shapeType_ == SHAPE_BOX)
+        return halfSize_.y_;
+
+    // Round shapes are only as high as the circle of their radius at the column, a capsule adds the caps to its cylinder
+    const float radius = halfSize_.x_;
+    const float distanceSquared = localX * localX + localZ * localZ;
+    if (distanceSquared >= radius * radius)
+        return 0.f;
+    if (shapeType_ == SHAPE_CYLINDER)
+        return halfSize_.y_;
+    const float cap = sqrtf(radius * radius - distanceSquared);
+    return shapeType_ == SHAPE_CAPSULE ? halfSize_.y_ - radius + cap : cap;
+}
+
+void OceanBuoyancy::EndStep()
+{
+    if (!body_)
+        return;
+
+    if (submergedVolume_ > 0.f)
+    {
+        body_->ApplyForce(force_);
+        body_->ApplyTorque(torque_);
+    }
+    body_ = nullptr;
+    stepOcean_ = nullptr;
+}
+
+void OceanBuoyancy::OnSceneSet(Scene* scene)
+{
+    // The OceanManager of the scene steps all floating bodies together
+    if (scene)
+    {
+        oceanManager_ = scene->GetOrCreateComponent<OceanManager>(LOCAL);
+        if (oceanManager_)
+            oceanManager_->AddBuoyancy(this);
+    }
+    else if (oceanManager_)
+    {
+        oceanManager_->RemoveBuoyancy(this);
+        oceanManager_.Reset();
+    }
+}
+
+}
+
+#endif
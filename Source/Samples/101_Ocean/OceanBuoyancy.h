@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Scene/Component.h>
+
+
+namespace Urho3D
+{
+
+class CollisionShape;
+class Ocean;
+class OceanManager;
+class RigidBody;
+
+/// Floats the RigidBody of its node on an Ocean. The CollisionShape is divided into vertical water columns, whose
+/// submerged part gives the buoyancy, the torque and the drag. Boxes, spheres, capsules and cylinders are divided exactly,
+/// other shapes by their world bounding box. The OceanManager evaluates all bodies of the scene in one parallel pass
+/// before each physics step.
+class URHO3D_API OceanBuoyancy : public Component
+{
+    URHO3D_OBJECT(OceanBuoyancy, Component);
+
+public:
+    OceanBuoyancy(Context* context);
+    ~OceanBuoyancy();
+
+    /// Register object factory.
+    static void RegisterObject(Context* context);
+
+    /// Set the ocean the body floats on. Without one the first enabled ocean of the scene is used
+    void SetOcean(Ocean* ocean);
+    Ocean* GetOcean() const { return ocean_; }
+    /// Set the number of water columns along each horizontal axis of the shape
+    void SetSampleResolution(const unsigned value) { sampleResolution_ = Clamp(value, 1u, 16u); }
+    unsigned GetSampleResolution() const { return sampleResolution_; }
+    /// Set the number of iterations of each surface query. Fewer than the default of the ocean are enough for floating
+    void SetQueryIterations(const unsigned value) { queryIterations_ = Max(value, 1u); }
+    unsigned GetQueryIterations() const { return queryIterations_; }
+    /// Set the density of the water in kg/m³
+    void SetDensity(const float value) { density_ = Max(value, 0.f); }
+    float GetDensity() const { return density_; }
+    /// Set the drag force per velocity through the water when fully submerged
+    void SetLinearDrag(const float value) { linearDrag_ = Max(value, 0.f); }
+    float GetLinearDrag() const { return linearDrag_; }
+    /// Set the drag torque per angular velocity when fully submerged
+    void SetAngularDrag(const float value) { angularDrag_ = Max(value, 0.f); }
+    float GetAngularDrag() const { return angularDrag_; }
+
+    /// Returns the submerged volume of the last physics step
+    float GetSubmergedVolume() const { return submergedVolume_; }
+    /// Returns the submerged part of the shape volume of the last physics step
+    float GetSubmergedFraction() const { return shapeVolume_ > 0.f ? submergedVolume_ / shapeVolume_ : 0.f; }
+    /// Returns the force applied in the last physics step
+    const Vector3& GetForce() const { return force_; }
+    /// Returns the torque about the center of mass applied in the last physics step
+    const Vector3& GetTorque() const { return torque_; }
+
+    /// Caches the state of the body on the main thread. Returns false if the body is not floated in this step. Called by
+    /// OceanManager
+    bool BeginStep(Ocean* defaultOcean, const Vector3& gravity);
+    /// Evaluates the water columns. Only touches this component and the prepared ocean, so different components may be
+    /// evaluated on different threads. emitters is scratch memory of the calling thread for an index of every emitter.
+    /// Called by OceanManager
+    void EvaluateStep(unsigned* emitters);
+    /// Applies the force and the torque to the body on the main thread. Called by OceanManager
+    void EndStep();
+
+protected:
+    /// Handle scene being assigned.
+    virtual void OnSceneSet(Scene* scene) override;
+
+private:
+    /// Returns the half height of the column at a horizontal position of the shape, zero outside of the shape
+    float GetColumnHalfHeight(const float localX, const float localZ) const;
+
+    /// The ocean the body floats on
+    WeakPtr<Ocean> ocean_;
+    /// The OceanManager that steps this component
+    WeakPtr<OceanManager> oceanManager_;
+    /// Water columns along each horizontal axis of the shape
+    unsigned sampleResolution_ = 2;
+    /// Iterations of each surface query
+    unsigned queryIterations_ = 2;
+    /// Density of the water
+    float density_ = 1000.f;
+    /// Drag force per velocity
+    float linearDrag_ = 200.f;
+    /// Drag torque per angular velocity
+    float angularDrag_ = 100.f;
+
+    /// Body and ocean of the current step, only valid between BeginStep and EndStep
+    RigidBody* body_ = nullptr;
+    Ocean* stepOcean_ = nullptr;
+    /// Shape of the columns, another shape than these is replaced by its bounding box
+    int shapeType_ = 0;
+    /// Transform from the shape to world space
+    Matrix3x4 shapeTransform_;
+    /// Half size of the box around the shape
+    Vector3 halfSize_;
+    /// World center of mass and velocities of the body
+    Vector3 centerOfMass_;
+    Vector3 linearVelocity_;
+    Vector3 angularVelocity_;
+    /// Gravity of the physics world
+    Vector3 gravity_;
+    /// World volume of the shape
+    float shapeVolume_ = 0.f;
+    /// World volume of the columns per unit of their height in shape space
+    float volumePerHeight_ = 0.f;
+    /// The approximation of an unsupported shape was reported
+    bool shapeWarningShown_ = false;
+
+    /// Results of the last step
+    float submergedVolume_ = 0.f;
+    Vector3 force_;
+    Vector3 torque_;
+};
+
+}
@@ -0,0 +1,129 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+
+#include "OceanFrameArena.h"
+
+
+namespace Urho3D
+{
+
+/// Smallest block an arena takes from the heap
+static const unsigned OCEAN_ARENA_MIN_BLOCK = 16384;
+
+/// Returns the first offset from used on at which the address in the block is aligned
+static unsigned GetAlignedOffset(const unsigned char* block, const unsigned used, const unsigned alignment)
+{
+    const size_t address = reinterpret_cast<size_t>(block) + used;
+    return used + static_cast<unsigned>(((address + alignment - 1) & ~static_cast<size_t>(alignment - 1)) - address);
+}
+
+OceanArena::~OceanArena()
+{
+    for (unsigned char* block : fullBlocks_)
+        delete[] block;
+    delete[] block_;
+}
+
+void* OceanArena::Allocate(const unsigned size, const unsigned alignment)
+{
+    unsigned offset = block_ ? GetAlignedOffset(block_, blockUsed_, alignment) : 0;
+    if (!block_ || offset + size > blockSize_)
+    {
+        // Keep the full block until the next Reset, the earlier allocations still point into it
+        if (block_)
+            fullBlocks_.Push(block_);
+        blockSize_ = Max(Max(size + alignment, blockSize_ * 2), OCEAN_ARENA_MIN_BLOCK);
+        block_ = new unsigned char[blockSize_];
+        ++numHeapAllocations_;
+        blockUsed_ = 0;
+        offset = GetAlignedOffset(block_, 0, alignment);
+    }
+
+    used_ += offset - blockUsed_ + size;
+    blockUsed_ = offset + size;
+    return block_ + offset;
+}
+
+void OceanArena::Reset()
+{
+    highWaterMark_ = Max(highWaterMark_, used_);
+
+    // Replace the blocks by one that holds everything of the last use. Without overflow this is all there is to do
+    if (!fullBlocks_.Empty())
+    {
+        for (unsigned char* block : fullBlocks_)
+            delete[] block;
+        fullBlocks_.Clear();
+        delete[] block_;
+        blockSize_ = Max(highWaterMark_ + highWaterMark_ / 4, OCEAN_ARENA_MIN_BLOCK);
+        block_ = new unsigned char[blockSize_];
+        ++numHeapAllocations_;
+    }
+
+    blockUsed_ = 0;
+    used_ = 0;
+}
+
+OceanFrameArena::~OceanFrameArena()
+{
+    SetNumThreads(0);
+}
+
+void OceanFrameArena::SetNumThreads(const unsigned numThreads)
+{
+    for (auto& arenas : arenas_)
+    {
+        for (unsigned i = numThreads; i < arenas.Size(); ++i)
+            delete arenas[i];
+        const unsigned oldSize = arenas.Size();
+        arenas.Resize(numThreads);
+        for (unsigned i = oldSize; i < numThreads; ++i)
+            arenas[i] = new OceanArena();
+    }
+}
+
+void OceanFrameArena::EndFrame()
+{
+    unsigned used = 0;
+    for (OceanArena* arena : arenas_[current_])
+        used += arena->GetUsed();
+    highWaterMark_ = Max(highWaterMark_, used);
+
+    current_ = 1 - current_;
+    for (OceanArena* arena : arenas_[current_])
+        arena->Reset();
+}
+
+unsigned OceanFrameArena::GetNumHeapAllocations() const
+{
+    unsigned count = 0;
+    for (const auto& arenas : arenas_)
+    {
+        for (const OceanArena* arena : arenas)
+            count += arena->GetNumHeapAllocations();
+    }
+    return count;
+}
+
+}
@@ -0,0 +1,105 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+
+
+namespace Urho3D
+{
+
+/// Linear allocator for short-lived plain data. Allocations are only released together by Reset. Memory that does not
+/// fit is taken from the heap, and the next Reset replaces all blocks by one that holds the high-water mark, so that the
+/// arena takes no heap memory after the first frames of a steady workload. Not thread-safe, every thread uses its own
+class OceanArena
+{
+public:
+    OceanArena() = default;
+    ~OceanArena();
+
+    /// Returns size bytes aligned to alignment, which must be a power of two
+    void* Allocate(const unsigned size, const unsigned alignment = 16);
+    /// Returns uninitialized memory for count values of a plain type
+    template <class T> T* Allocate(const unsigned count)
+    {
+        return static_cast<T*>(Allocate(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16));
+    }
+    /// Releases all allocations at once
+    void Reset();
+
+    /// Returns the bytes allocated since the last Reset, including the alignment
+    unsigned GetUsed() const { return used_; }
+    /// Returns the largest number of bytes that were allocated between two resets
+    unsigned GetHighWaterMark() const { return highWaterMark_; }
+    /// Returns the number of blocks taken from the heap so far
+    unsigned GetNumHeapAllocations() const { return numHeapAllocations_; }
+
+private:
+    /// Not copyable, the allocations point into the blocks
+    OceanArena(const OceanArena& rhs) = delete;
+    OceanArena& operator =(const OceanArena& rhs) = delete;
+
+    /// Block that is allocated from
+    unsigned char* block_ = nullptr;
+    unsigned blockSize_ = 0;
+    unsigned blockUsed_ = 0;
+    /// Blocks that filled up since the last Reset
+    PODVector<unsigned char*> fullBlocks_;
+    unsigned used_ = 0;
+    unsigned highWaterMark_ = 0;
+    unsigned numHeapAllocations_ = 0;
+};
+
+/// Double-buffered arenas of one frame, one per thread. What is allocated in a frame stays valid until EndFrame is
+/// called the second time after, so the results of a frame can be read while the next one is built
+class OceanFrameArena
+{
+public:
+    OceanFrameArena() = default;
+    ~OceanFrameArena();
+
+    /// Set the number of threads including the main thread, which has index 0. Not while work items are running
+    void SetNumThreads(const unsigned numThreads);
+    unsigned GetNumThreads() const { return arenas_[0].Size(); }
+    /// Returns the arena of a thread in this frame, the thread index of a work item or 0 for the main thread
+    OceanArena& Get(const unsigned threadIndex = 0) { return *arenas_[current_][threadIndex]; }
+    /// Resets the arenas of the previous frame, each in O(1), and allocates the next frame from them
+    void EndFrame();
+
+    /// Returns the largest number of bytes that the threads allocated in one frame
+    unsigned GetHighWaterMark() const { return highWaterMark_; }
+    /// Returns the number of blocks that all arenas took from the heap so far
+    unsigned GetNumHeapAllocations() const;
+
+private:
+    /// Not copyable, the arenas are owned
+    OceanFrameArena(const OceanFrameArena& rhs) = delete;
+    OceanFrameArena& operator =(const OceanFrameArena& rhs) = delete;
+
+    /// The arenas of the current and of the previous frame
+    PODVector<OceanArena*> arenas_[2];
+    unsigned current_ = 0;
+    unsigned highWaterMark_ = 0;
+};
+
+}
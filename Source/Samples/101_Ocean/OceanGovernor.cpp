@@ -0,0 +1,123 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/IO/Log.h>
+
+#include "OceanGovernor.h"
+
+
+namespace Urho3D
+{
+
+/// Quality levels, ordered from full quality to the cheapest setting
+struct QualityLevel
+{
+    /// Fraction of the active waves that are evaluated
+    float waveFraction_;
+    /// Every how many frames the ocean is animated
+    unsigned updateInterval_;
+};
+
+static const QualityLevel QUALITY_LEVELS[] =
+{
+    { 1.0f, 1 },
+    { 0.75f, 1 },
+    { 0.5f, 1 },
+    { 0.25f, 1 },
+    { 0.25f, 2 },
+    { 0.25f, 3 },
+    { 0.25f, 4 }
+};
+
+static const unsigned NUM_QUALITY_LEVELS = sizeof(QUALITY_LEVELS) / sizeof(QUALITY_LEVELS[0]);
+
+OceanGovernor::OceanGovernor(Context* context) :
+    Object(context)
+{
+}
+
+OceanGovernor::~OceanGovernor()
+{
+}
+
+void OceanGovernor::SetBudget(const float value)
+{
+    budget_ = Max(value, 0.f);
+    if (!IsEnabled())
+        SetLevel(0);
+}
+
+void OceanGovernor::AddSample(const float msec)
+{
+    if (!IsEnabled())
+        return;
+
+    // The ocean is not animated on every frame at the lower levels, so spread the cost over the skipped frames
+    const float cost = msec / GetUpdateInterval();
+    if (averageCost_ == 0.f)
+        averageCost_ = cost;
+    else
+        averageCost_ += (cost - averageCost_) * smoothing_;
+
+    if (++samplesSinceChange_ < settleSamples_)
+        return;
+
+    // Degrade as soon as the budget is exceeded, but only restore with a safety margin to avoid oscillation
+    if (averageCost_ > budget_ && level_ + 1 < NUM_QUALITY_LEVELS)
+        SetLevel(level_ + 1);
+    else if (averageCost_ < budget_ * restoreThreshold_ && level_ > 0)
+        SetLevel(level_ - 1);
+}
+
+unsigned OceanGovernor::GetMaxWaves(const unsigned numWaves) const
+{
+    const unsigned maxWaves = static_cast<unsigned>(CeilToInt(numWaves * QUALITY_LEVELS[level_].waveFraction_));
+    return Min(Max(maxWaves, 1u), numWaves);
+}
+
+unsigned OceanGovernor::GetUpdateInterval() const
+{
+    return QUALITY_LEVELS[level_].updateInterval_;
+}
+
+String OceanGovernor::GetReport() const
+{
+    if (!level_)
+        return "Ocean at full quality";
+
+    return ToString("Ocean quality level %u: %d%% of the waves, animated every %u frame(s), %.2f ms of %.2f ms budget",
+        level_, RoundToInt(QUALITY_LEVELS[level_].waveFraction_ * 100.f), GetUpdateInterval(), averageCost_, budget_);
+}
+
+void OceanGovernor::SetLevel(const unsigned level)
+{
+    samplesSinceChange_ = 0;
+    if (level == level_)
+        return;
+
+    level_ = level;
+    URHO3D_LOGINFO(GetReport());
+}
+
+}
@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+
+
+namespace Urho3D
+{
+
+/// The OceanGovernor lowers the quality of an Ocean when its update cost exceeds a frame-time budget.
+class OceanGovernor : public Object
+{
+    URHO3D_OBJECT(OceanGovernor, Object);
+
+public:
+
+    OceanGovernor(Context* context);
+    ~OceanGovernor();
+
+    /// Set the budget in milliseconds per frame. A budget of 0 disables the governor
+    void SetBudget(const float value);
+    float GetBudget() const { return budget_; }
+    bool IsEnabled() const { return budget_ > 0.f; }
+
+    /// Adds the measured cost in milliseconds of a frame in which the ocean was animated
+    void AddSample(const float msec);
+
+    /// Returns the current quality level, 0 is full quality
+    unsigned GetLevel() const { return level_; }
+    /// Returns the number of waves to evaluate out of numWaves at the current level
+    unsigned GetMaxWaves(const unsigned numWaves) const;
+    /// Returns every how many frames the ocean is animated at the current level
+    unsigned GetUpdateInterval() const;
+    /// Returns the smoothed cost per frame in milliseconds
+    float GetAverageCost() const { return averageCost_; }
+    /// Returns a description of what is currently degraded
+    String GetReport() const;
+
+private:
+
+    /// Changes the quality level and logs the change
+    void SetLevel(const unsigned level);
+
+    /// Budget in milliseconds, 0 if disabled
+    float budget_ = 0.f;
+    /// Smoothed cost per frame in milliseconds
+    float averageCost_ = 0.f;
+    /// Current quality level
+    unsigned level_ = 0;
+    /// Samples since the last change of the level
+    unsigned samplesSinceChange_ = 0;
+
+    /// Weight of a new sample in the smoothed cost
+    const float smoothing_ = 0.1f;
+    /// The quality is only restored if the cost stays below this fraction of the budget
+    const float restoreThreshold_ = 0.5f;
+    /// Number of samples to wait after a change before the next one
+    const unsigned settleSamples_ = 30;
+};
+
+}
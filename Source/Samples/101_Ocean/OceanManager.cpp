@@ -0,0 +1,449 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#ifdef URHO3D_PHYSICS
+#include <Urho3D/Physics/PhysicsEvents.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#endif
+#include <Urho3D/Scene/Scene.h>
+#include <Urho3D/Scene/SceneEvents.h>
+
+#include "Ocean.h"
+#include "OceanBuoyancy.h"
+#include "OceanManager.h"
+
+
+namespace Urho3D
+{
+
+extern const char* SUBSYSTEM_CATEGORY;
+
+static void AnimateChunksWork(const WorkItem* item, unsigned threadIndex)
+{
+    const OceanManager::Chunk* start = reinterpret_cast<const OceanManager::Chunk*>(item->start_);
+    const OceanManager::Chunk* end = reinterpret_cast<const OceanManager::Chunk*>(item->end_);
+    for (const OceanManager::Chunk* chunk = start; chunk != end; ++chunk)
+        chunk->ocean_->AnimateRange(chunk->begin_, chunk->end_);
+}
+
+static void UpdateSurfaceCachesWork(const WorkItem* item, unsigned threadIndex)
+{
+    const OceanManager::Chunk* chunk = reinterpret_cast<const OceanManager::Chunk*>(item->start_);
+    OceanManager* oceanManager = reinterpret_cast<OceanManager*>(item->aux_);
+    chunk->ocean_->UpdateSurfaceCacheRange(chunk->begin_, chunk->end_, oceanManager->AllocateEmitterScratch(threadIndex));
+}
+
+/// Returns true if two chunks animate some of the same vertices of a shared vertex buffer
+static bool ShareVertices(const OceanManager::Chunk& lhs, const OceanManager::Chunk& rhs)
+{
+    return lhs.ocean_->GetWaterVertexBuffer() == rhs.ocean_->GetWaterVertexBuffer() && lhs.begin_ < rhs.end_ &&
+        rhs.begin_ < lhs.end_;
+}
+
+#ifdef URHO3D_PHYSICS
+static void EvaluateBuoyanciesWork(const WorkItem* item, unsigned threadIndex)
+{
+    OceanBuoyancy** start = reinterpret_cast<OceanBuoyancy**>(item->start_);
+    OceanBuoyancy** end = reinterpret_cast<OceanBuoyancy**>(item->end_);
+    unsigned* emitters = reinterpret_cast<OceanManager*>(item->aux_)->AllocateEmitterScratch(threadIndex);
+    for (OceanBuoyancy** buoyancy = start; buoyancy != end; ++buoyancy)
+        (*buoyancy)->EvaluateStep(emitters);
+}
+#endif
+
+OceanManager::OceanManager(Context* context) :
+    Component(context)
+{
+#ifdef URHO3D_PHYSICS
+    SubscribeToEvent(E_PHYSICSPRESTEP, URHO3D_HANDLER(OceanManager, HandlePhysicsPreStep));
+#endif
+}
+
+OceanManager::~OceanManager()
+{
+}
+
+void OceanManager::RegisterObject(Context* context)
+{
+    context->RegisterFactory<OceanManager>(SUBSYSTEM_CATEGORY);
+#ifdef URHO3D_PHYSICS
+    OceanBuoyancy::RegisterObject(context);
+#endif
+}
+
+void OceanManager::OnSceneSet(Scene* scene)
+{
+    // Only the updates of the own scene advance its oceans, so a paused scene or its time scale is respected
+    if (scene)
+        SubscribeToEvent(scene, E_SCENEUPDATE, URHO3D_HANDLER(OceanManager, HandleSceneUpdate));
+    else
+        UnsubscribeFromEvent(E_SCENEUPDATE);
+}
+
+void OceanManager::AddOcean(Ocean* ocean)
+{
+    if (!oceans_.Contains(ocean))
+        oceans_.Push(ocean);
+}
+
+void OceanManager::RemoveOcean(Ocean* ocean)
+{
+    oceans_.Remove(ocean);
+}
+
+void OceanManager::AddBuoyancy(OceanBuoyancy* buoyancy)
+{
+    if (!buoyancies_.Contains(buoyancy))
+        buoyancies_.Push(buoyancy);
+}
+
+void OceanManager::RemoveBuoyancy(OceanBuoyancy* buoyancy)
+{
+    buoyancies_.Remove(buoyancy);
+}
+
+unsigned* OceanManager::AllocateEmitterScratch(const unsigned threadIndex)
+{
+    return frameArena_.Get(threadIndex).Allocate<unsigned>(maxEmitters_);
+}
+
+void OceanManager::UpdateMaxEmitters()
+{
+    maxEmitters_ = 0;
+    for (Ocean* ocean : oceans_)
+    {
+        if (ocean->IsEnabledEffective())
+            maxEmitters_ = Max(maxEmitters_, ocean->GetWaveManager()->GetEmitters().Size());
+    }
+}
+
+void OceanManager::AnimateNow(Ocean* ocean)
+{
+    const PODVector<OceanTile>& tiles = ocean->GetTiles();
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    const unsigned numItems = queue ? Min(queue->GetNumThreads() + 1, tiles.Size()) : 1;
+    if (numItems <= 1)
+    {
+        for (const auto& tile : tiles)
+            ocean->AnimateRange(tile.begin_, tile.end_);
+        return;
+    }
+
+    // One item per thread with about the same number of tiles
+    frameArena_.SetNumThreads(queue->GetNumThreads() + 1);
+    Chunk* chunks = frameArena_.Get().Allocate<Chunk>(tiles.Size());
+    for (unsigned i = 0; i < tiles.Size(); ++i)
+        chunks[i] = Chunk{ ocean, tiles[i].begin_, tiles[i].end_ };
+    for (unsigned i = 0; i < numItems; ++i)
+    {
+        SharedPtr<WorkItem> item = queue->GetFreeItem();
+        item->priority_ = M_MAX_UNSIGNED;
+        item->workFunction_ = AnimateChunksWork;
+        item->start_ = chunks + tiles.Size() * i / numItems;
+        item->end_ = chunks + tiles.Size() * (i + 1) / numItems;
+        queue->AddWorkItem(item);
+    }
+    queue->Complete(M_MAX_UNSIGNED);
+}
+
+void OceanManager::HandleSceneUpdate(StringHash eventType, VariantMap& eventData)
+{
+    URHO3D_PROFILE(Ocean);
+
+    using namespace SceneUpdate;
+
+    // Take the scaled time step of the scene, which is stored as a float
+    float timeStep = eventData[P_TIMESTEP].GetFloat();
+
+    HiresTimer animationTimer;
+
+    // The first ocean of each shared surface computes it, the temporal LOD follows the largest of them on screen and the
+    // normals are animated if any of them was shaded
+    sharedSurfaces_.Clear();
+    for (Ocean* ocean : oceans_)
+    {
+        ocean->SetSurfaceSource(nullptr);
+        if (!ocean->IsEnabledEffective() || !ocean->IsSharedSurfaceEnabled())
+            continue;
+
+        Ocean* source = nullptr;
+        for (Ocean* sharedSurface : sharedSurfaces_)
+        {
+            if (sharedSurface->SharesSurfaceWith(*ocean))
+            {
+                source = sharedSurface;
+                break;
+            }
+        }
+
+        if (source)
+        {
+            source->AddSharedViews(*ocean);
+            ocean->SetSurfaceSource(source);
+        }
+        else
+            sharedSurfaces_.Push(ocean);
+    }
+
+    // The job data of this frame lives in the frame arena, at most one chunk per tile
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    const unsigned numItems = queue ? queue->GetNumThreads() + 1 : 1;
+    frameArena_.SetNumThreads(numItems);
+    unsigned maxChunks = 0;
+    for (Ocean* ocean : oceans_)
+        maxChunks += ocean->GetTiles().Size();
+    chunks_ = frameArena_.Get().Allocate<Chunk>(maxChunks);
+    numChunks_ = 0;
+
+    // Prepare all oceans on the main thread and collect their vertex chunks
+    animatedOceans_.Clear();
+    unsigned numVertices = 0;
+    for (Ocean* ocean : oceans_)
+    {
+        if (!ocean->IsEnabledEffective())
+            continue;
+
+        // Server oceans only advance, their surface is evaluated when it is queried
+        if (ocean->IsServerMode() || (ocean->IsSharedSurfaceEnabled() && !sharedSurfaces_.Contains(ocean)))
+        {
+            ocean->SkipAnimation(timeStep);
+            continue;
+        }
+
+        if (!ocean->BeginAnimation(timeStep))
+            continue;
+
+        animatedOceans_.Push(ocean);
+    }
+
+    // Oceans of the same model without a shared surface write the same vertex buffer. The chunks of the same tile follow
+    // each other, so that they end up in one work item
+    for (unsigned i = 0; i < animatedOceans_.Size(); ++i)
+    {
+        VertexBuffer* vertexBuffer = animatedOceans_[i]->GetWaterVertexBuffer();
+        bool collected = false;
+        for (unsigned j = 0; j < i && !collected; ++j)
+            collected = animatedOceans_[j]->GetWaterVertexBuffer() == vertexBuffer;
+        if (collected)
+            continue;
+
+        unsigned numTiles = 0;
+        for (unsigned j = i; j < animatedOceans_.Size(); ++j)
+        {
+            if (animatedOceans_[j]->GetWaterVertexBuffer() == vertexBuffer)
+                numTiles = Max(numTiles, animatedOceans_[j]->GetTiles().Size());
+        }
+        for (unsigned tile = 0; tile < numTiles; ++tile)
+        {
+            for (unsigned j = i; j < animatedOceans_.Size(); ++j)
+            {
+                Ocean* ocean = animatedOceans_[j];
+                const PODVector<OceanTile>& tiles = ocean->GetTiles();
+                if (ocean->GetWaterVertexBuffer() != vertexBuffer || tile >= tiles.Size())
+                    continue;
+
+                chunks_[numChunks_++] = Chunk{ ocean, tiles[tile].begin_, tiles[tile].end_ };
+                numVertices += tiles[tile].end_ - tiles[tile].begin_;
+            }
+        }
+    }
+
+    // The surface caches of all oceans are evaluated together with the animation, in rows of their grids
+    UpdateMaxEmitters();
+    cacheChunks_ = frameArena_.Get().Allocate<Chunk>(oceans_.Size() * 4 * numItems);
+    numCacheChunks_ = 0;
+    for (Ocean* ocean : oceans_)
+    {
+        if (!ocean->IsEnabledEffective())
+            continue;
+
+        // Several rows per item, but enough items to fill the gaps the animation leaves on the threads
+        const unsigned numRows = ocean->BeginSurfaceCache();
+        const unsigned rowsPerItem = Max((numRows + 4 * numItems - 1) / (4 * numItems), 1u);
+        for (unsigned row = 0; row < numRows; row += rowsPerItem)
+            cacheChunks_[numCacheChunks_++] = Chunk{ ocean, row, Min(row + rowsPerItem, numRows) };
+    }
+
+    if (numChunks_ || numCacheChunks_)
+    {
+        URHO3D_PROFILE(AnimateVertices);
+
+        // Split the chunks of all oceans into one work item per thread with about the same number of vertices
+        const unsigned verticesPerItem = (numVertices + numItems - 1) / numItems;
+
+        if (numItems == 1)
+        {
+            for (const Chunk* chunk = chunks_; chunk != chunks_ + numChunks_; ++chunk)
+                chunk->ocean_->AnimateRange(chunk->begin_, chunk->end_);
+            for (const Chunk* chunk = cacheChunks_; chunk != cacheChunks_ + numCacheChunks_; ++chunk)
+                chunk->ocean_->UpdateSurfaceCacheRange(chunk->begin_, chunk->end_, AllocateEmitterScratch(0));
+        }
+        else
+        {
+            for (Chunk* chunk = cacheChunks_; chunk != cacheChunks_ + numCacheChunks_; ++chunk)
+            {
+                SharedPtr<WorkItem> item = queue->GetFreeItem();
+                item->priority_ = M_MAX_UNSIGNED;
+                item->workFunction_ = UpdateSurfaceCachesWork;
+                item->start_ = chunk;
+                item->aux_ = this;
+                queue->AddWorkItem(item);
+            }
+
+            unsigned itemStart = 0;
+            unsigned itemVertices = 0;
+            for (unsigned i = 0; i < numChunks_; ++i)
+            {
+                // An item never ends between two chunks that write the same vertices
+                itemVertices += chunks_[i].end_ - chunks_[i].begin_;
+                if (i + 1 < numChunks_ && (itemVertices < verticesPerItem || ShareVertices(chunks_[i], chunks_[i + 1])))
+                    continue;
+
+                SharedPtr<WorkItem> item = queue->GetFreeItem();
+                item->priority_ = M_MAX_UNSIGNED;
+                item->workFunction_ = AnimateChunksWork;
+                item->start_ = chunks_ + itemStart;
+                item->end_ = chunks_ + i + 1;
+                queue->AddWorkItem(item);
+
+                itemStart = i + 1;
+                itemVertices = 0;
+            }
+
+            // Single join, the main thread works on the items as well
+            queue->Complete(M_MAX_UNSIGNED);
+        }
+    }
+
+    // Share the measured cost between the oceans by their number of vertices
+    const float msec = animationTimer.GetUSec(false) / 1000.f;
+    for (Ocean* ocean : animatedOceans_)
+    {
+        unsigned oceanVertices = 0;
+        for (const auto& tile : ocean->GetTiles())
+            oceanVertices += tile.end_ - tile.begin_;
+        ocean->EndAnimation(numVertices ? msec * oceanVertices / numVertices : 0.f);
+    }
+
+    // Update every WaveSystem once per frame, even if several oceans or scenes share it. The oceans take their time from
+    // it, so they stay in step
+    Time* time = GetSubsystem<Time>();
+    const unsigned frameNumber = time ? time->GetFrameNumber() : 0;
+    for (Ocean* ocean : oceans_)
+    {
+        WaveSystem* waveSystem = ocean->GetWaveManager();
+        if (!ocean->IsEnabledEffective() || waveSystem->GetUpdateFrame() == frameNumber)
+            continue;
+
+        waveSystem->SetUpdateFrame(frameNumber);
+        waveSystem->Update(timeStep);
+    }
+
+    frameArena_.EndFrame();
+}
+
+#ifdef URHO3D_PHYSICS
+void OceanManager::HandlePhysicsPreStep(StringHash eventType, VariantMap& eventData)
+{
+    using namespace PhysicsPreStep;
+
+    // Only the physics world of this scene floats the bodies
+    PhysicsWorld* world = static_cast<PhysicsWorld*>(eventData[P_WORLD].GetPtr());
+    if (buoyancies_.Empty() || !world || world->GetScene() != GetScene())
+        return;
+
+    URHO3D_PROFILE(OceanBuoyancy);
+    HiresTimer buoyancyTimer;
+
+    Ocean* defaultOcean = nullptr;
+    for (Ocean* ocean : oceans_)
+    {
+        if (ocean->IsEnabledEffective())
+        {
+            defaultOcean = ocean;
+            break;
+        }
+    }
+
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    const unsigned numThreads = queue ? queue->GetNumThreads() + 1 : 1;
+    frameArena_.SetNumThreads(numThreads);
+
+    // Cache the state of all bodies on the main thread
+    steppedBuoyancies_ = frameArena_.Get().Allocate<OceanBuoyancy*>(buoyancies_.Size());
+    numSteppedBuoyancies_ = 0;
+    for (OceanBuoyancy* buoyancy : buoyancies_)
+    {
+        if (buoyancy->BeginStep(defaultOcean, world->GetGravity()))
+            steppedBuoyancies_[numSteppedBuoyancies_++] = buoyancy;
+    }
+    if (!numSteppedBuoyancies_)
+    {
+        buoyancyTime_ = buoyancyTimer.GetUSec(false) / 1000.f;
+        return;
+    }
+
+    // The waves of every ocean are prepared once for all queries of this step
+    for (Ocean* ocean : oceans_)
+    {
+        if (ocean->IsEnabledEffective())
+            ocean->PrepareSurfaceQueries();
+    }
+
+    const unsigned numItems = Min(numThreads, numSteppedBuoyancies_);
+    UpdateMaxEmitters();
+
+    if (numItems == 1)
+    {
+        unsigned* emitters = AllocateEmitterScratch(0);
+        for (unsigned i = 0; i < numSteppedBuoyancies_; ++i)
+            steppedBuoyancies_[i]->EvaluateStep(emitters);
+    }
+    else
+    {
+        // One item per thread with about the same number of bodies, the main thread works on the items as well
+        for (unsigned i = 0; i < numItems; ++i)
+        {
+            SharedPtr<WorkItem> item = queue->GetFreeItem();
+            item->priority_ = M_MAX_UNSIGNED;
+            item->workFunction_ = EvaluateBuoyanciesWork;
+            item->start_ = steppedBuoyancies_ + numSteppedBuoyancies_ * i / numItems;
+            item->end_ = steppedBuoyancies_ + numSteppedBuoyancies_ * (i + 1) / numItems;
+            item->aux_ = this;
+            queue->AddWorkItem(item);
+        }
+        queue->Complete(M_MAX_UNSIGNED);
+    }
+
+    // Forces are applied on the main thread
+    for (unsigned i = 0; i < numSteppedBuoyancies_; ++i)
+        steppedBuoyancies_[i]->EndStep();
+    buoyancyTime_ = buoyancyTimer.GetUSec(false) / 1000.f;
+}
+#endif
+
+}
@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Scene/Component.h>
+
+#include "OceanFrameArena.h"
+
+
+namespace Urho3D
+{
+
+class Ocean;
+class OceanBuoyancy;
+class WaveSystem;
+
+/// Scene component that updates all Ocean components of the scene in one parallel job.
+class URHO3D_API OceanManager : public Component
+{
+    URHO3D_OBJECT(OceanManager, Component);
+
+public:
+    OceanManager(Context* context);
+    ~OceanManager();
+
+    /// Register object factory.
+    static void RegisterObject(Context* context);
+
+    /// Add an Ocean to be updated. Called by Ocean.
+    void AddOcean(Ocean* ocean);
+    /// Remove an Ocean. Called by Ocean.
+    void RemoveOcean(Ocean* ocean);
+    /// Returns the oceans of the scene
+    const PODVector<Ocean*>& GetOceans() const { return oceans_; }
+    /// Add a floating body to be stepped. Called by OceanBuoyancy.
+    void AddBuoyancy(OceanBuoyancy* buoyancy);
+    /// Remove a floating body. Called by OceanBuoyancy.
+    void RemoveBuoyancy(OceanBuoyancy* buoyancy);
+    /// Returns the floating bodies of the scene
+    const PODVector<OceanBuoyancy*>& GetBuoyancies() const { return buoyancies_; }
+
+    /// Animates all tiles of an ocean right away, outside of the update. Joins the work items of M_MAX_UNSIGNED priority
+    void AnimateNow(Ocean* ocean);
+
+    /// Returns the memory for short-lived data of the ocean update. What the main thread allocates from Get() stays
+    /// valid until the update of the next frame has finished
+    OceanFrameArena& GetFrameArena() { return frameArena_; }
+    /// Returns the largest number of bytes the ocean update allocated from the frame arena in one frame
+    unsigned GetFrameArenaHighWaterMark() const { return frameArena_.GetHighWaterMark(); }
+    /// Returns the duration of the buoyancy pass of the last physics step in milliseconds
+    float GetBuoyancyTime() const { return buoyancyTime_; }
+    /// Returns memory for the emitter indices of the surface queries of a work item, from the frame arena of its thread
+    unsigned* AllocateEmitterScratch(const unsigned threadIndex);
+
+    /// A range of consecutive vertices of an Ocean
+    struct Chunk
+    {
+        Ocean* ocean_;
+        unsigned begin_;
+        unsigned end_;
+    };
+
+protected:
+    /// Handle scene being assigned.
+    virtual void OnSceneSet(Scene* scene);
+
+private:
+    /// Handle the update event of the scene.
+    void HandleSceneUpdate(StringHash eventType, VariantMap& eventData);
+    /// Sizes the emitter scratch of the work items for the emitters of all oceans. Called on the main thread
+    void UpdateMaxEmitters();
+#ifdef URHO3D_PHYSICS
+    /// Handle the physics pre-step event.
+    void HandlePhysicsPreStep(StringHash eventType, VariantMap& eventData);
+#endif
+
+    /// All oceans of the scene
+    PODVector<Ocean*> oceans_;
+    /// Oceans that are animated in the current frame
+    PODVector<Ocean*> animatedOceans_;
+    /// Short-lived memory of the frames, e.g. the job data of the work items
+    OceanFrameArena frameArena_;
+    /// Vertex chunks of all animated oceans, in the frame arena
+    Chunk* chunks_ = nullptr;
+    unsigned numChunks_ = 0;
+    /// Row chunks of the surface caches of all oceans, in the frame arena
+    Chunk* cacheChunks_ = nullptr;
+    unsigned numCacheChunks_ = 0;
+    /// Oceans that compute a shared surface for other oceans in the current frame
+    PODVector<Ocean*> sharedSurfaces_;
+    /// All floating bodies of the scene
+    PODVector<OceanBuoyancy*> buoyancies_;
+    /// Floating bodies that are evaluated in the current physics step, in the frame arena
+    OceanBuoyancy** steppedBuoyancies_ = nullptr;
+    unsigned numSteppedBuoyancies_ = 0;
+    /// Duration of the last buoyancy pass
+    float buoyancyTime_ = 0.f;
+    /// Largest number of emitters of an enabled ocean, the size of the emitter scratch in the current pass
+    unsigned maxEmitters_ = 0;
+};
+
+}
@@ -0,0 +1,216 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+#include "OceanMeshCache.h"
+
+
+namespace Urho3D
+{
+
+/// Version of the cache file format, increase on every change of the layout or of the derived data
+static const unsigned OCEAN_MESH_CACHE_VERSION = 2;
+/// Bytes of a vertex in the cache file: the x, y and z position and the index of the duplicate
+static const unsigned OCEAN_MESH_CACHE_VERTEX_SIZE = 3 * sizeof(float) + sizeof(unsigned);
+/// Bytes of a bounding box in the cache file
+static const unsigned OCEAN_MESH_CACHE_BOX_SIZE = 2 * sizeof(Vector3);
+/// Bytes of a tile in the cache file: the first and the end vertex and the bounds
+static const unsigned OCEAN_MESH_CACHE_TILE_SIZE = 2 * sizeof(unsigned) + OCEAN_MESH_CACHE_BOX_SIZE;
+
+/// Identifies the version of a model file without reading it
+struct ModelFileStamp
+{
+    unsigned size_ = 0;
+    unsigned modifiedTime_ = 0;
+};
+
+/// Returns the size and the modification time of the model file. Fails for models inside packages, which have no file
+static bool GetModelFileStamp(Model* model, ModelFileStamp& stamp)
+{
+    ResourceCache* cache = model->GetSubsystem<ResourceCache>();
+    FileSystem* fileSystem = model->GetSubsystem<FileSystem>();
+    if (!cache || !fileSystem || model->GetName().Empty())
+        return false;
+
+    const String modelFileName = cache->GetResourceFileName(model->GetName());
+    if (modelFileName.Empty())
+        return false;
+
+    File file(model->GetContext(), modelFileName);
+    if (!file.IsOpen())
+        return false;
+
+    stamp.size_ = file.GetSize();
+    stamp.modifiedTime_ = fileSystem->GetLastModifiedTime(modelFileName);
+    return true;
+}
+
+template <class T> static void WriteArray(Serializer& dest, const PODVector<T>& values)
+{
+    if (!values.Empty())
+        dest.Write(&values[0], values.Size() * sizeof(T));
+}
+
+template <class T> static bool ReadArray(Deserializer& source, PODVector<T>& values, const unsigned size)
+{
+    values.Resize(size);
+    return !size || source.Read(&values[0], size * sizeof(T)) == size * sizeof(T);
+}
+
+String GetOceanMeshCacheName(Context* context, const String& modelName)
+{
+    FileSystem* fileSystem = context->GetSubsystem<FileSystem>();
+    if (!fileSystem || modelName.Empty())
+        return String::EMPTY;
+
+    // The resource directories may be read-only or shipped, so the cache is kept with the temporary files of the user
+    return fileSystem->GetTemporaryDir() + "OceanMeshCache/" + ReplaceExtension(modelName.Replaced('/', '_'), ".oceancache");
+}
+
+bool LoadOceanMeshCache(Model* model, OceanMeshData& meshData)
+{
+    FileSystem* fileSystem = model->GetSubsystem<FileSystem>();
+    const String cacheName = GetOceanMeshCacheName(model->GetContext(), model->GetName());
+    ModelFileStamp stamp;
+    if (cacheName.Empty() || !fileSystem->FileExists(cacheName) || !GetModelFileStamp(model, stamp))
+        return false;
+
+    File file(model->GetContext(), cacheName);
+    if (!file.IsOpen() || file.ReadFileID() != "OCMC" || file.ReadUInt() != OCEAN_MESH_CACHE_VERSION)
+        return false;
+
+    // A changed model file has a different size or modification time. The name tells apart models whose cache names
+    // collide
+    if (file.ReadString() != model->GetName() || file.ReadUInt() != stamp.size_ || file.ReadUInt() != stamp.modifiedTime_)
+        return false;
+
+    // The counts are checked against the length of the file before any array is resized, a truncated or corrupt file
+    // is rejected. Each array is read with a single call
+    const unsigned numVertices = file.ReadUInt();
+    if (numVertices > (file.GetSize() - file.GetPosition()) / OCEAN_MESH_CACHE_VERTEX_SIZE)
+        return false;
+    if (!ReadArray(file, meshData.positionsX_, numVertices) || !ReadArray(file, meshData.positionsY_, numVertices) ||
+        !ReadArray(file, meshData.positionsZ_, numVertices) || !ReadArray(file, meshData.duplicates_, numVertices))
+        return false;
+
+    const unsigned numTiles = file.ReadUInt();
+    const unsigned remaining = file.GetSize() - file.GetPosition();
+    if (remaining < OCEAN_MESH_CACHE_BOX_SIZE || numTiles > (remaining - OCEAN_MESH_CACHE_BOX_SIZE) / OCEAN_MESH_CACHE_TILE_SIZE)
+        return false;
+
+    meshData.tiles_.Resize(numTiles);
+    for (auto& tile : meshData.tiles_)
+    {
+        tile.begin_ = file.ReadUInt();
+        tile.end_ = file.ReadUInt();
+        tile.bounds_ = file.ReadBoundingBox();
+        if (tile.begin_ > tile.end_ || tile.end_ > numVertices)
+            return false;
+    }
+
+    meshData.bounds_ = file.ReadBoundingBox();
+    return true;
+}
+
+bool SaveOceanMeshCache(Model* model, const OceanMeshData& meshData)
+{
+    FileSystem* fileSystem = model->GetSubsystem<FileSystem>();
+    const String cacheName = GetOceanMeshCacheName(model->GetContext(), model->GetName());
+    ModelFileStamp stamp;
+    if (cacheName.Empty() || !GetModelFileStamp(model, stamp))
+        return false;
+
+    fileSystem->CreateDir(GetPath(cacheName));
+    File file(model->GetContext(), cacheName, FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        URHO3D_LOGWARNING("Could not write ocean mesh cache for " + model->GetName());
+        return false;
+    }
+
+    file.WriteFileID("OCMC");
+    file.WriteUInt(OCEAN_MESH_CACHE_VERSION);
+    file.WriteString(model->GetName());
+    file.WriteUInt(stamp.size_);
+    file.WriteUInt(stamp.modifiedTime_);
+    file.WriteUInt(meshData.GetNumVertices());
+    WriteArray(file, meshData.positionsX_);
+    WriteArray(file, meshData.positionsY_);
+    WriteArray(file, meshData.positionsZ_);
+    WriteArray(file, meshData.duplicates_);
+    file.WriteUInt(meshData.tiles_.Size());
+    for (const auto& tile : meshData.tiles_)
+    {
+        file.WriteUInt(tile.begin_);
+        file.WriteUInt(tile.end_);
+        file.WriteBoundingBox(tile.bounds_);
+    }
+    file.WriteBoundingBox(meshData.bounds_);
+    return true;
+}
+
+OceanMeshData ExtractOceanMeshData(const PODVector<Vector3>& positions)
+{
+    OceanMeshData meshData;
+
+    meshData.positionsX_.Resize(positions.Size());
+    meshData.positionsY_.Resize(positions.Size());
+    meshData.positionsZ_.Resize(positions.Size());
+    for (unsigned i = 0; i < positions.Size(); ++i)
+    {
+        meshData.positionsX_[i] = positions[i].x_;
+        meshData.positionsY_[i] = positions[i].y_;
+        meshData.positionsZ_[i] = positions[i].z_;
+        meshData.bounds_.Merge(positions[i]);
+    }
+
+    meshData.duplicates_ = ExtractDuplicates(positions);
+    meshData.tiles_ = ExtractTiles(positions);
+    meshData.gridRows_ = ExtractGridRows(positions);
+    return meshData;
+}
+
+OceanMeshData PrepareOceanMeshData(Model* model, const PODVector<Vector3>& vertexPositions)
+{
+    OceanMeshData meshData;
+    if (LoadOceanMeshCache(model, meshData) && meshData.GetNumVertices() == vertexPositions.Size())
+    {
+        meshData.gridRows_ = ExtractGridRows(vertexPositions);
+        return meshData;
+    }
+
+    meshData = ExtractOceanMeshData(vertexPositions);
+    if (SaveOceanMeshCache(model, meshData))
+        URHO3D_LOGINFO("Wrote ocean mesh cache for " + model->GetName());
+
+    return meshData;
+}
+
+}
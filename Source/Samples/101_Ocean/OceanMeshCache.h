@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/BoundingBox.h>
+
+#include "OceanAlgorithms.h"
+
+
+namespace Urho3D
+{
+// Forward declarations
+class Context;
+class Model;
+
+/// Data derived from a water plane model. The rest positions are stored as separate x, y and z arrays
+struct OceanMeshData
+{
+    PODVector<float> positionsX_;
+    PODVector<float> positionsY_;
+    PODVector<float> positionsZ_;
+    /// Index of the first vertex with the same position for each vertex
+    PODVector<unsigned> duplicates_;
+    PODVector<OceanTile> tiles_;
+    /// Runs of vertices with a constant step, cheap to find and not stored in the cache file
+    PODVector<OceanGridRow> gridRows_;
+    BoundingBox bounds_;
+
+    unsigned GetNumVertices() const { return positionsX_.Size(); }
+};
+
+/// Returns the name of the cache file of a model in the temporary directory of the user
+String GetOceanMeshCacheName(Context* context, const String& modelName);
+/// Loads the mesh data of a model from its cache file. Fails if the file is missing, truncated or was written for a
+/// different model or an older version of the model file, which is told by its size and modification time
+bool LoadOceanMeshCache(Model* model, OceanMeshData& meshData);
+/// Writes the mesh data of a model into its cache file. Fails for models inside packages
+bool SaveOceanMeshCache(Model* model, const OceanMeshData& meshData);
+/// Computes the mesh data from the vertex positions of a model
+OceanMeshData ExtractOceanMeshData(const PODVector<Vector3>& vertexPositions);
+/// Loads the mesh data from the cache file or computes and caches it if that is not possible. Safe to call from worker threads
+OceanMeshData PrepareOceanMeshData(Model* model, const PODVector<Vector3>& vertexPositions);
+
+}
@@ -0,0 +1,332 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+#ifdef URHO3D_PHYSICS
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Physics/RigidBody.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "Ocean.h"
+#include "OceanBuoyancy.h"
+#include "OceanManager.h"
+#endif
+#include "OceanSoak.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <unistd.h>
+#endif
+
+
+namespace Urho3D
+{
+
+/// Returns the resident memory of the process in bytes, 0 where it can not be measured
+static unsigned long long GetResidentMemory()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+#elif defined(__APPLE__)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+        return info.resident_size;
+#elif defined(__linux__)
+    // The second value of statm is the resident set in pages
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file)
+    {
+        unsigned long size = 0;
+        unsigned long resident = 0;
+        const int numValues = fscanf(file, "%lu %lu", &size, &resident);
+        fclose(file);
+        if (numValues == 2)
+            return static_cast<unsigned long long>(resident) * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return 0;
+}
+
+/// Returns the displacement and the height of the waves at P like CalculateGerstnerWaves, in double precision
+static void CalculateReferenceWaves(const Vector2& P, const PODVector<WaveSystem::Wave>& waves, const PODVector<double>& phases,
+    double& x, double& y, double& z)
+{
+    x = y = z = 0.0;
+    for (unsigned i = 0; i < waves.Size(); ++i)
+    {
+        const WaveSystem::Wave& wave = waves[i];
+        if (wave.l_ == 0.f)
+            continue;
+
+        const double w = 2.0 * M_PI / wave.l_;
+        double q = 0.0;
+        if (wave.a_ != 0.f)
+            q = wave.q_ / (w * wave.a_ * waves.Size());
+
+        const double inner = w * (static_cast<double>(wave.d_.x_) * P.x_ + static_cast<double>(wave.d_.y_) * P.y_) + phases[i];
+        x += q * wave.a_ * wave.d_.x_ * cos(inner);
+        y += q * wave.a_ * wave.d_.y_ * cos(inner);
+        z += wave.a_ * sin(inner);
+    }
+}
+
+OceanSoak::OceanSoak(Context* context) :
+    Object(context)
+{
+}
+
+OceanSoak::~OceanSoak()
+{
+}
+
+OceanSoak::Result OceanSoak::Run()
+{
+    SharedPtr<WaveSystem> waveSystem = waveSystem_;
+    if (!waveSystem)
+        waveSystem = new WaveSystem(context_);
+
+    Result result;
+    result.numFrames_ = static_cast<unsigned>(duration_ / timeStep_ + 0.5);
+    result.duration_ = result.numFrames_ * static_cast<double>(timeStep_);
+
+    const unsigned checkFrames = Max(static_cast<unsigned>(checkInterval_ / timeStep_ + 0.5f), 1u);
+    const unsigned numChecks = Max(result.numFrames_ / checkFrames, 1u);
+    const unsigned windowChecks = Max(numChecks / numWindows_, 1u);
+    const unsigned numWaves = static_cast<unsigned>(Max(waveSystem->GetWaveCount(), 0));
+
+    referencePhases_.Clear();
+    lastTrackedId_ = 0;
+    double windowCost = 0.0;
+    unsigned check = 0;
+    HiresTimer timer;
+
+    for (unsigned frame = 1; frame <= result.numFrames_; ++frame)
+    {
+        const bool checked = frame % checkFrames == 0;
+        if (checked)
+            timer.Reset();
+
+        waveSystem->Update(timeStep_);
+        TrackWaves(waveSystem->GetWaves(), frame);
+        if (!checked)
+            continue;
+
+        const float error = EvaluateProbes(waveSystem->GetWaves(), frame);
+        windowCost += timer.GetUSec(false);
+
+        const double gameTime = frame * static_cast<double>(timeStep_);
+        if (error > result.maxSurfaceError_)
+        {
+            result.maxSurfaceError_ = error;
+            result.maxSurfaceErrorTime_ = gameTime;
+        }
+        result.maxClockDrift_ = Max(result.maxClockDrift_, Abs(waveSystem->GetTotalTime() - gameTime));
+
+        // The first window is the baseline, it also covers the creation of the first waves. The containers tell which
+        // part grows, the resident memory also catches what they do not own
+        const unsigned memory = waveSystem->GetMemoryUse();
+        const unsigned long long residentMemory = GetResidentMemory();
+        const unsigned waves = waveSystem->GetWaves().Size();
+        if (check < windowChecks)
+        {
+            result.baseMemory_ = result.maxMemory_ = memory;
+            result.baseResidentMemory_ = result.maxResidentMemory_ = residentMemory;
+            result.minWaves_ = result.maxWaves_ = waves;
+        }
+        else
+        {
+            result.maxMemory_ = Max(result.maxMemory_, memory);
+            result.maxResidentMemory_ = Max(result.maxResidentMemory_, residentMemory);
+            result.minWaves_ = Min(result.minWaves_, waves);
+            result.maxWaves_ = Max(result.maxWaves_, waves);
+        }
+
+        if (++check % windowChecks == 0)
+        {
+            const float cost = static_cast<float>(windowCost / windowChecks);
+            if (check == windowChecks)
+                result.firstFrameCost_ = cost;
+            result.maxFrameCost_ = Max(result.maxFrameCost_, cost);
+            windowCost = 0.0;
+        }
+    }
+
+#ifdef URHO3D_PHYSICS
+    if (numBuoyancyBodies_)
+        result.buoyancyTime_ = MeasureBuoyancy();
+#endif
+
+    if (result.firstFrameCost_ > 0.f && result.maxFrameCost_ > result.firstFrameCost_ * maxCostGrowth_)
+        result.failures_ += ToString("Frame cost grew from %.1f us to %.1f us. ", result.firstFrameCost_, result.maxFrameCost_);
+    if (result.maxMemory_ > result.baseMemory_ + maxMemoryGrowth_)
+        result.failures_ += ToString("Memory grew from %u to %u bytes. ", result.baseMemory_, result.maxMemory_);
+    if (result.baseResidentMemory_ && result.maxResidentMemory_ > result.baseResidentMemory_ + maxResidentMemoryGrowth_)
+        result.failures_ += ToString("Resident memory grew from %llu to %llu bytes. ", result.baseResidentMemory_,
+            result.maxResidentMemory_);
+    if (result.minWaves_ + maxWaveDeviation_ < numWaves || result.maxWaves_ > numWaves + maxWaveDeviation_)
+        result.failures_ += ToString("Wave count varied between %u and %u instead of %u. ", result.minWaves_, result.maxWaves_,
+            numWaves);
+    if (result.maxSurfaceError_ > maxSurfaceError_)
+        result.failures_ += ToString("Surface error reached %f at %.0f s. ", result.maxSurfaceError_,
+            result.maxSurfaceErrorTime_);
+    if (result.maxClockDrift_ > maxClockDrift_)
+        result.failures_ += ToString("WaveSystem time drifted %.6f s from the game time. ", result.maxClockDrift_);
+    if (result.buoyancyTime_ > maxBuoyancyTime_)
+        result.failures_ += ToString("Buoyancy of %u bodies took %.3f ms per physics step. ", numBuoyancyBodies_,
+            result.buoyancyTime_);
+    result.passed_ = result.failures_.Empty();
+
+    if (result.passed_)
+        URHO3D_LOGINFO(GetReport(result));
+    else
+        URHO3D_LOGERROR(GetReport(result));
+    return result;
+}
+
+String OceanSoak::GetReport(const Result& result)
+{
+    String report = ToString("Ocean soak of %.1f hours in %u frames %s: frame cost %.1f us to %.1f us, memory %u to %u bytes, "
+        "resident memory %llu to %llu bytes, %u to %u waves, surface error %f, clock drift %.6f s, buoyancy %.3f ms",
+        result.duration_ / 3600.0, result.numFrames_, result.passed_ ? "passed" : "failed", result.firstFrameCost_,
+        result.maxFrameCost_, result.baseMemory_, result.maxMemory_, result.baseResidentMemory_, result.maxResidentMemory_,
+        result.minWaves_, result.maxWaves_, result.maxSurfaceError_, result.maxClockDrift_, result.buoyancyTime_);
+    if (!result.passed_)
+        report += ". " + result.failures_;
+    return report;
+}
+
+void OceanSoak::TrackWaves(const PODVector<WaveSystem::Wave>& waves, const unsigned frame)
+{
+    // New waves are appended with increasing ids, so only the end of the list needs to be checked
+    for (unsigned i = waves.Size(); i-- > 0 && waves[i].id_ > lastTrackedId_;)
+    {
+        ReferencePhase reference;
+        reference.id_ = waves[i].id_;
+        reference.frame_ = frame;
+        reference.phase_ = waves[i].phase_;
+        referencePhases_.Push(reference);
+    }
+    if (!waves.Empty())
+        lastTrackedId_ = Max(lastTrackedId_, waves.Back().id_);
+}
+
+float OceanSoak::EvaluateProbes(const PODVector<WaveSystem::Wave>& waves, const unsigned frame)
+{
+    // Advance the phases since the waves were first seen in double precision and forget the waves that have ended
+    probePhases_.Resize(waves.Size());
+    for (unsigned i = 0; i < waves.Size(); ++i)
+    {
+        probePhases_[i] = waves[i].phase_;
+        for (const auto& reference : referencePhases_)
+        {
+            if (reference.id_ == waves[i].id_)
+            {
+                const double angularSpeed = waves[i].l_ != 0.f ? 2.0 * M_PI * waves[i].s_ / waves[i].l_ : 0.0;
+                probePhases_[i] = reference.phase_ + angularSpeed * (frame - reference.frame_) * timeStep_;
+                break;
+            }
+        }
+    }
+    for (unsigned i = referencePhases_.Size(); i-- > 0;)
+    {
+        bool alive = false;
+        for (const auto& wave : waves)
+            alive |= wave.id_ == referencePhases_[i].id_;
+        if (!alive)
+            referencePhases_.Erase(i);
+    }
+
+    // The same path as an Ocean without spectrum and emitters
+    PrepareGerstnerWaves(waves, gerstnerWaves_);
+    const GerstnerKernel kernel = GetGerstnerKernel(gerstnerWaves_.Size(), precision_);
+
+    probeResults_.Resize(numProbes_ * numProbes_);
+    const float spacing = probeExtent_ / numProbes_;
+    for (unsigned i = 0; i < probeResults_.Size(); ++i)
+    {
+        const Vector2 P((i % numProbes_) * spacing, (i / numProbes_) * spacing);
+        probeResults_[i] = kernel(P, gerstnerWaves_.Buffer(), gerstnerWaves_.Size(), 1.f, 0.f);
+    }
+
+    float maxError = 0.f;
+    for (unsigned i = 0; i < probeResults_.Size(); ++i)
+    {
+        const Vector2 P((i % numProbes_) * spacing, (i / numProbes_) * spacing);
+        double x, y, z;
+        CalculateReferenceWaves(P, waves, probePhases_, x, y, z);
+
+        const Vector3& position = probeResults_[i].first;
+        const double error = Max(Abs(position.x_ - P.x_ - x), Max(Abs(position.y_ - P.y_ - y), Abs(position.z_ - z)));
+        maxError = Max(maxError, static_cast<float>(error));
+    }
+    return maxError;
+}
+
+
+#ifdef URHO3D_PHYSICS
+float OceanSoak::MeasureBuoyancy()
+{
+    // Boats of 4 x 2 x 8 m in rows of 25, 10 m apart, heavy enough to float half submerged
+    SharedPtr<Scene> scene(new Scene(context_));
+    scene->CreateComponent<Octree>();
+    scene->CreateComponent<PhysicsWorld>();
+    Ocean* ocean = scene->CreateChild("Ocean")->CreateComponent<Ocean>();
+    ocean->SetServerMode(true);
+    ocean->GetWaveManager()->SetWaveCount(16);
+    for (unsigned i = 0; i < numBuoyancyBodies_; ++i)
+    {
+        Node* node = scene->CreateChild("Boat");
+        node->SetPosition(Vector3((i % 25) * 10.f, 0.f, (i / 25) * 10.f));
+        node->CreateComponent<RigidBody>()->SetMass(32000.f);
+        node->CreateComponent<CollisionShape>()->SetBox(Vector3(4.f, 2.f, 8.f));
+        node->CreateComponent<OceanBuoyancy>();
+    }
+
+    // The first second settles the bodies and grows the frame arena, the next ten are measured. The physics world steps
+    // once per update at its default of 60 steps per second
+    OceanManager* oceanManager = scene->GetComponent<OceanManager>();
+    const float timeStep = 1.f / 60.f;
+    const unsigned numMeasuredSteps = 600;
+    float buoyancyTime = 0.f;
+    for (unsigned frame = 0; frame < 60 + numMeasuredSteps; ++frame)
+    {
+        scene->Update(timeStep);
+        if (frame >= 60)
+            buoyancyTime += oceanManager->GetBuoyancyTime();
+    }
+    return buoyancyTime / numMeasuredSteps;
+}
+#endif
+
+}
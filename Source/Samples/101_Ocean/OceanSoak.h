@@ -0,0 +1,186 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+
+#include "OceanAlgorithms.h"
+#include "WaveSystem.h"
+
+
+namespace Urho3D
+{
+
+/// The OceanSoak runs a WaveSystem headless over a long span of game time, as fast as possible, and checks that the
+/// cost per frame, the memory, the wave count and the precision of the surface do not drift. With physics it also holds
+/// the buoyancy pass of many floating bodies against its budget.
+class OceanSoak : public Object
+{
+    URHO3D_OBJECT(OceanSoak, Object);
+
+public:
+
+    /// Measurements of a run
+    struct Result
+    {
+        /// True if no measurement exceeded its threshold
+        bool passed_ = true;
+        /// Description of every exceeded threshold
+        String failures_;
+        /// Simulated game time in seconds and number of frames
+        double duration_ = 0.0;
+        unsigned numFrames_ = 0;
+        /// Mean cost in microseconds of a checked frame in the first window and in the most expensive window
+        float firstFrameCost_ = 0.f;
+        float maxFrameCost_ = 0.f;
+        /// Capacity of the containers of the WaveSystem in bytes at the end of the first window and at most afterwards
+        unsigned baseMemory_ = 0;
+        unsigned maxMemory_ = 0;
+        /// Resident memory of the process in bytes as reported by the system at the end of the first window and at most
+        /// afterwards, 0 where it can not be measured
+        unsigned long long baseResidentMemory_ = 0;
+        unsigned long long maxResidentMemory_ = 0;
+        /// Smallest and greatest number of waves after the first window
+        unsigned minWaves_ = 0;
+        unsigned maxWaves_ = 0;
+        /// Greatest distance of the surface to the double precision reference and the game time it occurred at
+        float maxSurfaceError_ = 0.f;
+        double maxSurfaceErrorTime_ = 0.0;
+        /// Greatest difference in seconds between the time of the WaveSystem and the game time
+        double maxClockDrift_ = 0.0;
+        /// Mean duration in milliseconds of the buoyancy pass of a physics step, 0 if it was not measured
+        float buoyancyTime_ = 0.f;
+    };
+
+    OceanSoak(Context* context);
+    ~OceanSoak();
+
+    /// Set the WaveSystem to run. If none is set, a WaveSystem with default values is created for every run
+    void SetWaveSystem(WaveSystem* waveSystem) { waveSystem_ = waveSystem; }
+    WaveSystem* GetWaveSystem() const { return waveSystem_; }
+
+    /// Set the simulated game time in seconds, two weeks by default
+    void SetDuration(const double value) { duration_ = Max(value, 0.0); }
+    double GetDuration() const { return duration_; }
+    /// Set the time step of a frame in seconds
+    void SetTimeStep(const float value) { timeStep_ = Max(value, M_EPSILON); }
+    float GetTimeStep() const { return timeStep_; }
+    /// Set the game time in seconds between two checked frames
+    void SetCheckInterval(const float value) { checkInterval_ = Max(value, 0.f); }
+    float GetCheckInterval() const { return checkInterval_; }
+    /// Set the number of vertices along each side of the probed grid and the size of the grid in the plane of the waves
+    void SetProbes(const unsigned count, const float extent) { numProbes_ = Max(count, 1u); probeExtent_ = extent; }
+    /// Set the precision of the evaluated kernel
+    void SetPrecision(const WavePrecision value) { precision_ = value; }
+    WavePrecision GetPrecision() const { return precision_; }
+
+    /// Set the greatest allowed ratio between the frame cost of a window and of the first window
+    void SetMaxCostGrowth(const float value) { maxCostGrowth_ = value; }
+    float GetMaxCostGrowth() const { return maxCostGrowth_; }
+    /// Set the greatest allowed growth of the container capacity of the WaveSystem in bytes after the first window
+    void SetMaxMemoryGrowth(const unsigned value) { maxMemoryGrowth_ = value; }
+    unsigned GetMaxMemoryGrowth() const { return maxMemoryGrowth_; }
+    /// Set the greatest allowed growth of the resident memory of the process in bytes after the first window. The system
+    /// reports it in pages, so small leaks only show over a long run
+    void SetMaxResidentMemoryGrowth(const unsigned value) { maxResidentMemoryGrowth_ = value; }
+    unsigned GetMaxResidentMemoryGrowth() const { return maxResidentMemoryGrowth_; }
+    /// Set the greatest allowed difference between the number of waves and the wave count of the WaveSystem
+    void SetMaxWaveDeviation(const unsigned value) { maxWaveDeviation_ = value; }
+    unsigned GetMaxWaveDeviation() const { return maxWaveDeviation_; }
+    /// Set the greatest allowed distance in world units between the surface and the double precision reference
+    void SetMaxSurfaceError(const float value) { maxSurfaceError_ = value; }
+    float GetMaxSurfaceError() const { return maxSurfaceError_; }
+    /// Set the greatest allowed difference in seconds between the time of the WaveSystem and the game time
+    void SetMaxClockDrift(const float value) { maxClockDrift_ = value; }
+    float GetMaxClockDrift() const { return maxClockDrift_; }
+    /// Set the number of floating bodies whose buoyancy pass is measured with physics, 0 to skip the measurement
+    void SetNumBuoyancyBodies(const unsigned value) { numBuoyancyBodies_ = value; }
+    unsigned GetNumBuoyancyBodies() const { return numBuoyancyBodies_; }
+    /// Set the greatest allowed mean duration in milliseconds of the buoyancy pass of a physics step
+    void SetMaxBuoyancyTime(const float value) { maxBuoyancyTime_ = value; }
+    float GetMaxBuoyancyTime() const { return maxBuoyancyTime_; }
+
+    /// Runs the simulation and compares the measurements with the thresholds. A set WaveSystem is advanced by the run
+    Result Run();
+    /// Returns a description of the measurements of a run
+    static String GetReport(const Result& result);
+
+private:
+
+    /// Phase of a Wave when it was first seen, the reference advances it in double precision
+    struct ReferencePhase
+    {
+        unsigned id_;
+        unsigned frame_;
+        double phase_;
+    };
+
+    /// Remembers the phases of the waves that appeared in this frame
+    void TrackWaves(const PODVector<WaveSystem::Wave>& waves, const unsigned frame);
+    /// Evaluates the probed grid like an animated Ocean tile and returns the greatest distance to the double precision
+    /// reference
+    float EvaluateProbes(const PODVector<WaveSystem::Wave>& waves, const unsigned frame);
+#ifdef URHO3D_PHYSICS
+    /// Floats the bodies on an ocean with 16 waves and returns the mean duration of the buoyancy pass of a physics step in
+    /// milliseconds
+    float MeasureBuoyancy();
+#endif
+
+    /// The WaveSystem to run, or null
+    SharedPtr<WaveSystem> waveSystem_;
+
+    /// Simulated game time in seconds
+    double duration_ = 14.0 * 24.0 * 3600.0;
+    float timeStep_ = 1.f / 60.f;
+    float checkInterval_ = 600.f;
+    /// Number of windows over which the frame cost is averaged
+    const unsigned numWindows_ = 16;
+
+    /// The probed grid
+    unsigned numProbes_ = 32;
+    float probeExtent_ = 64.f;
+    WavePrecision precision_ = WAVE_PRECISION_EXACT;
+
+    /// Thresholds
+    float maxCostGrowth_ = 1.5f;
+    unsigned maxMemoryGrowth_ = 4096;
+    unsigned maxResidentMemoryGrowth_ = 1024 * 1024;
+    unsigned maxWaveDeviation_ = 0;
+    float maxSurfaceError_ = 0.001f;
+    float maxClockDrift_ = 0.001f;
+    float maxBuoyancyTime_ = 1.f;
+
+    /// Number of floating bodies of the buoyancy measurement
+    unsigned numBuoyancyBodies_ = 500;
+
+    /// Reference phases of the tracked waves and the greatest tracked id
+    PODVector<ReferencePhase> referencePhases_;
+    unsigned lastTrackedId_ = 0;
+
+    /// Scratch data of a checked frame
+    PODVector<GerstnerWave> gerstnerWaves_;
+    PODVector<PositionAndNormal> probeResults_;
+    PODVector<double> probePhases_;
+};
+
+}
@@ -0,0 +1,584 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+#include "../Precompiled.h"
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#ifdef URHO3D_PHYSICS
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Physics/RigidBody.h>
+#endif
+#include <Urho3D/Scene/Scene.h>
+
+#include "Ocean.h"
+#include "OceanAlgorithms.h"
+#include "OceanBuoyancy.h"
+#include "OceanManager.h"
+#include "OceanTests.h"
+#include "OceanTileStore.h"
+#include "WaveSystem.h"
+
+#include <cmath>
+#include <cstring>
+
+
+namespace Urho3D
+{
+
+/// Greatest average size of a delta in bytes, sent twice per second
+static const unsigned MAX_AVERAGE_DELTA_SIZE = 32;
+/// Greatest absolute errors of the sine and cosine of WAVE_PRECISION_HIGH and WAVE_PRECISION_FAST, as documented
+static const float MAX_SIN_COS_ERROR_HIGH = 4.5e-7f;
+static const float MAX_SIN_COS_ERROR_FAST = 3.7e-5f;
+/// Greatest distances between the positions and the normals of the grid rows and of the per-vertex kernel. The grid
+/// reaches 500 m from the origin, where a float resolves 3e-5 m
+static const float MAX_GRID_ROW_POSITION_ERROR = 1.0e-4f;
+static const float MAX_GRID_ROW_NORMAL_ERROR = 2.0e-4f;
+/// Number of floating bodies of the buoyancy budget, the soak run checks the duration of their pass
+static const unsigned NUM_BUDGET_BODIES = 500;
+/// Number of vertices along each side of the grid of the tile store unload test, enough for several tiles
+static const unsigned UNLOAD_GRID_SIZE = 48;
+
+/// Returns true if every value of the waves of both WaveSystems is identical
+static bool AreWavesIdentical(const WaveSystem& lhs, const WaveSystem& rhs)
+{
+    const PODVector<WaveSystem::Wave>& lhsWaves = lhs.GetWaves();
+    const PODVector<WaveSystem::Wave>& rhsWaves = rhs.GetWaves();
+    if (lhsWaves.Size() != rhsWaves.Size())
+        return false;
+
+    for (unsigned i = 0; i < lhsWaves.Size(); ++i)
+    {
+        const WaveSystem::Wave& a = lhsWaves[i];
+        const WaveSystem::Wave& b = rhsWaves[i];
+        if (a.id_ != b.id_ || a.q_ != b.q_ || a.s_ != b.s_ || a.l_ != b.l_ || a.a_ != b.a_ || a.d_ != b.d_ ||
+            a.phase_ != b.phase_ || a.retired_ != b.retired_ || a.targetSteepness_ != b.targetSteepness_ ||
+            a.targetAmplitude_ != b.targetAmplitude_ || a.startTime_ != b.startTime_ || a.fadeInEnd_ != b.fadeInEnd_ ||
+            a.fadeOutStart_ != b.fadeOutStart_ || a.fadeOutEnd_ != b.fadeOutEnd_)
+            return false;
+    }
+    return true;
+}
+
+/// Returns a flat grid of size x size vertices 1 m apart with positions and normals. The model has no name, so it
+/// bypasses the mesh cache
+static SharedPtr<Model> CreateGridModel(Context* context, const unsigned size)
+{
+    PODVector<float> vertexData;
+    for (unsigned z = 0; z < size; ++z)
+    {
+        for (unsigned x = 0; x < size; ++x)
+        {
+            vertexData.Push((float)x);
+            vertexData.Push(0.f);
+            vertexData.Push((float)z);
+            vertexData.Push(0.f);
+            vertexData.Push(1.f);
+            vertexData.Push(0.f);
+        }
+    }
+
+    PODVector<unsigned short> indexData;
+    for (unsigned z = 0; z + 1 < size; ++z)
+    {
+        for (unsigned x = 0; x + 1 < size; ++x)
+        {
+            const unsigned short corner = (unsigned short)(z * size + x);
+            indexData.Push(corner);
+            indexData.Push((unsigned short)(corner + size));
+            indexData.Push((unsigned short)(corner + 1));
+            indexData.Push((unsigned short)(corner + 1));
+            indexData.Push((unsigned short)(corner + size));
+            indexData.Push((unsigned short)(corner + size + 1));
+        }
+    }
+
+    // The ocean animates the shadow data, which headless mode forces anyway
+    SharedPtr<VertexBuffer> vertexBuffer(new VertexBuffer(context));
+    vertexBuffer->SetShadowed(true);
+    vertexBuffer->SetSize(size * size, MASK_POSITION | MASK_NORMAL);
+    vertexBuffer->SetData(vertexData.Buffer());
+    SharedPtr<IndexBuffer> indexBuffer(new IndexBuffer(context));
+    indexBuffer->SetShadowed(true);
+    indexBuffer->SetSize(indexData.Size(), false);
+    indexBuffer->SetData(indexData.Buffer());
+
+    SharedPtr<Geometry> geometry(new Geometry(context));
+    geometry->SetVertexBuffer(0, vertexBuffer);
+    geometry->SetIndexBuffer(indexBuffer);
+    geometry->SetDrawRange(TRIANGLE_LIST, 0, indexData.Size());
+
+    SharedPtr<Model> model(new Model(context));
+    model->SetNumGeometries(1);
+    model->SetGeometry(0, 0, geometry);
+    model->SetBoundingBox(BoundingBox(Vector3::ZERO, Vector3(size - 1.f, 0.f, size - 1.f)));
+    return model;
+}
+
+/// Advances the waves and the scene by a number of frames. The frame number does not advance in the tests, so the
+/// WaveSystem is updated here instead of by the OceanManager
+static void AnimateOcean(Scene* scene, Ocean* ocean, const unsigned numFrames)
+{
+    const float timeStep = 1.f / 60.f;
+    for (unsigned frame = 0; frame < numFrames; ++frame)
+    {
+        ocean->GetWaveManager()->Update(timeStep);
+        scene->Update(timeStep);
+    }
+}
+
+OceanTests::OceanTests(Context* context) :
+    Object(context)
+{
+}
+
+OceanTests::~OceanTests()
+{
+}
+
+OceanTests::Result OceanTests::Run()
+{
+    Result result;
+    TestReplication(result);
+    TestSinCos(result);
+    TestGridRows(result);
+    TestTileStore(result);
+    TestTileStoreUnload(result);
+#ifdef URHO3D_PHYSICS
+    TestBuoyancyBudget(result);
+#endif
+
+    if (result.passed_)
+        URHO3D_LOGINFO(GetReport(result));
+    else
+        URHO3D_LOGERROR(GetReport(result));
+    return result;
+}
+
+String OceanTests::GetReport(const Result& result)
+{
+    String report = ToString("Ocean tests %s, %u tests run", result.passed_ ? "passed" : "failed", result.numTests_);
+    if (!result.passed_)
+        report += ". " + result.failures_;
+    return report;
+}
+
+void OceanTests::TestReplication(Result& result)
+{
+    ++result.numTests_;
+
+    // The replica joins late through a snapshot
+    SharedPtr<WaveSystem> server(new WaveSystem(context_));
+    SharedPtr<WaveSystem> replica(new WaveSystem(context_));
+    replica->SetReplicated(true);
+    const float timeStep = 1.f / 60.f;
+    for (unsigned frame = 0; frame < 300; ++frame)
+        server->Update(timeStep);
+
+    VectorBuffer buffer;
+    server->WriteSnapshot(buffer);
+    buffer.Seek(0);
+    if (!replica->ReadSnapshot(buffer) || !AreWavesIdentical(*server, *replica))
+    {
+        AddFailure(result, "Replication: the replica differs after the snapshot. ");
+        return;
+    }
+
+    // Both advance on their own and the server sends a delta twice per second, also across a reset, cross-fades, a
+    // change of the wave count and the epoch wrap at 1024 s
+    unsigned deltaBytes = 0;
+    unsigned numDeltas = 0;
+    for (unsigned frame = 1; frame <= 90000; ++frame)
+    {
+        if (frame == 20000 || frame == 60000)
+            server->CrossFade();
+        else if (frame == 30000)
+            server->Reset();
+        else if (frame == 45000)
+            server->SetWaveCount(3);
+
+        server->Update(timeStep);
+        replica->Update(timeStep);
+
+        // A replica that joins while the retired waves fade out gets their fade-out times from the snapshot
+        if (frame == 60000)
+        {
+            SharedPtr<WaveSystem> lateReplica(new WaveSystem(context_));
+            lateReplica->SetReplicated(true);
+            buffer.Clear();
+            server->WriteSnapshot(buffer);
+            buffer.Seek(0);
+            if (!lateReplica->ReadSnapshot(buffer) || !AreWavesIdentical(*server, *lateReplica))
+            {
+                AddFailure(result, "Replication: the replica differs after a snapshot during a cross-fade. ");
+                return;
+            }
+        }
+
+        if (frame % 30)
+            continue;
+
+        buffer.Clear();
+        server->WriteDelta(buffer);
+        deltaBytes += buffer.GetSize();
+        ++numDeltas;
+        buffer.Seek(0);
+        if (!replica->ReadDelta(buffer) || !AreWavesIdentical(*server, *replica))
+        {
+            AddFailure(result, ToString("Replication: the replica differs after the delta of frame %u. ", frame));
+            return;
+        }
+    }
+
+    const float averageDeltaSize = static_cast<float>(deltaBytes) / numDeltas;
+    if (averageDeltaSize > MAX_AVERAGE_DELTA_SIZE)
+    {
+        AddFailure(result, ToString("Replication: deltas have %.1f bytes on average, more than %u. ", averageDeltaSize,
+            MAX_AVERAGE_DELTA_SIZE));
+    }
+}
+
+void OceanTests::TestSinCos(Result& result)
+{
+    ++result.numTests_;
+
+    const WavePrecision precisions[] = { WAVE_PRECISION_HIGH, WAVE_PRECISION_FAST };
+    const float maxErrors[] = { MAX_SIN_COS_ERROR_HIGH, MAX_SIN_COS_ERROR_FAST };
+    for (unsigned i = 0; i < 2; ++i)
+    {
+        // The step is no fraction of pi, so the sweep hits every part of the quadrants
+        float maxError = 0.f;
+        float maxErrorPhase = 0.f;
+        for (int j = -2000000; j <= 2000000; ++j)
+        {
+            const float phase = j * 0.005f;
+            float s;
+            float c;
+            CalculateWaveSinCos(phase, precisions[i], s, c);
+            const float error = static_cast<float>(Max(Abs(s - sin(static_cast<double>(phase))),
+                Abs(c - cos(static_cast<double>(phase)))));
+            if (error > maxError)
+            {
+                maxError = error;
+                maxErrorPhase = phase;
+            }
+        }
+
+        if (maxError > maxErrors[i])
+        {
+            AddFailure(result, ToString("SinCos: precision %u has an error of %e at %f, more than %e. ", precisions[i],
+                maxError, maxErrorPhase, maxErrors[i]));
+        }
+
+        // The quotient of the range reduction of these would not fit an int
+        const float largePhases[] = { 1.5e4f, 1.0e9f, 3.0e9f, -3.0e9f, 1.0e30f, -1.0e30f };
+        for (const float phase : largePhases)
+        {
+            float s;
+            float c;
+            CalculateWaveSinCos(phase, precisions[i], s, c);
+            if (!(Abs(s * s + c * c - 1.f) < 1.0e-3f))
+                AddFailure(result, ToString("SinCos: precision %u gives %f, %f at %e. ", precisions[i], s, c, phase));
+        }
+    }
+}
+
+void OceanTests::TestGridRows(Result& result)
+{
+    ++result.numTests_;
+
+    // 257 by 257 vertices over 200 m, away from the origin
+    const unsigned gridSize = 257;
+    PODVector<Vector3> positions;
+    for (unsigned z = 0; z < gridSize; ++z)
+    {
+        for (unsigned x = 0; x < gridSize; ++x)
+            positions.Push(Vector3(-100.f + x * 200.f / (gridSize - 1), 0.f, 300.f + z * 200.f / (gridSize - 1)));
+    }
+
+    const PODVector<OceanGridRow> rows = ExtractGridRows(positions);
+    unsigned numRowVertices = 0;
+    for (const auto& row : rows)
+        numRowVertices += row.end_ - row.begin_;
+    if (numRowVertices != positions.Size())
+    {
+        AddFailure(result, ToString("GridRows: the rows hold %u of %u vertices. ", numRowVertices, positions.Size()));
+        return;
+    }
+
+    const unsigned waveCounts[] = { 32, 40 };
+    PODVector<PositionAndNormal> rowResults(positions.Size());
+    for (const unsigned numWaves : waveCounts)
+    {
+        // Lengths from 0.8 m, a few vertices per crest, to 36 m in all directions
+        PODVector<WaveSystem::Wave> waves;
+        for (unsigned i = 0; i < numWaves; ++i)
+        {
+            const float angle = 0.7f * i;
+            waves.Push(WaveSystem::Wave(0.5f, 0.7f, 0.8f + i * 0.9f, 0.05f + 0.01f * i, Vector2(cosf(angle), sinf(angle))));
+            waves.Back().phase_ = 0.37f * i;
+        }
+
+        PODVector<GerstnerWave> gerstnerWaves;
+        PrepareGerstnerWaves(waves, gerstnerWaves);
+        for (const auto& row : rows)
+        {
+            CalculateGerstnerWavesAlongRow(row.origin_, row.step_, row.end_ - row.begin_, &gerstnerWaves[0], numWaves,
+                &rowResults[row.begin_]);
+        }
+
+        const GerstnerKernel kernel = GetGerstnerKernel(numWaves);
+        float maxPositionError = 0.f;
+        float maxNormalError = 0.f;
+        for (unsigned i = 0; i < positions.Size(); ++i)
+        {
+            const PositionAndNormal vertex = kernel(Vector2(positions[i].x_, positions[i].z_), &gerstnerWaves[0], numWaves,
+                1.f, 0.f);
+            maxPositionError = Max(maxPositionError, (vertex.first - rowResults[i].first).Length());
+            maxNormalError = Max(maxNormalError, (vertex.second - rowResults[i].second).Length());
+        }
+
+        if (maxPositionError > MAX_GRID_ROW_POSITION_ERROR || maxNormalError > MAX_GRID_ROW_NORMAL_ERROR)
+        {
+            AddFailure(result, ToString("GridRows: %u waves differ by %e in the positions and %e in the normals, more "
+                "than %e and %e. ", numWaves, maxPositionError, maxNormalError, MAX_GRID_ROW_POSITION_ERROR,
+                MAX_GRID_ROW_NORMAL_ERROR));
+        }
+    }
+}
+
+void OceanTests::TestTileStore(Result& result)
+{
+    ++result.numTests_;
+
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    if (!fileSystem)
+    {
+        AddFailure(result, "TileStore: no file system. ");
+        return;
+    }
+
+    // Tiles of different sizes, one of them spans several pages
+    const unsigned tileSizes[] = { 100, 1500, 1, 37 };
+    PODVector<OceanTile> tiles;
+    unsigned numVertices = 0;
+    for (const unsigned size : tileSizes)
+    {
+        OceanTile tile;
+        tile.begin_ = numVertices;
+        tile.end_ = numVertices + size;
+        tile.bounds_ = BoundingBox(Vector3(numVertices * 0.5f, -1.f, 0.f), Vector3(tile.end_ * 0.5f, 1.f, 10.f));
+        tiles.Push(tile);
+        numVertices += size;
+    }
+
+    OceanTileData vertices;
+    vertices.restX_.Resize(numVertices);
+    vertices.restY_.Resize(numVertices);
+    vertices.restZ_.Resize(numVertices);
+    vertices.duplicates_.Resize(numVertices);
+    vertices.shoreFactors_.Resize(numVertices);
+    for (unsigned i = 0; i < numVertices; ++i)
+    {
+        vertices.restX_[i] = i * 0.5f;
+        vertices.restY_[i] = sinf(i * 0.1f);
+        vertices.restZ_[i] = i * -0.25f;
+        vertices.duplicates_[i] = i % 7 ? i : i / 2;
+        vertices.shoreFactors_[i] = Vector2(1.f / (i + 1), i * 0.01f);
+    }
+
+    const String fileName = fileSystem->GetTemporaryDir() + "OceanTests.tiles";
+    const String truncatedName = fileSystem->GetTemporaryDir() + "OceanTestsTruncated.tiles";
+    if (!SaveOceanTileStore(context_, fileName, tiles, vertices))
+    {
+        AddFailure(result, "TileStore: could not write " + fileName + ". ");
+        return;
+    }
+
+    SharedPtr<OceanTileStore> store(new OceanTileStore(context_));
+    if (!store->Open(fileName))
+        AddFailure(result, "TileStore: could not open " + fileName + ". ");
+    else if (store->GetNumVertices() != numVertices || !store->MatchesTiles(tiles) || !store->HasShoreFactors())
+        AddFailure(result, "TileStore: the tile table differs. ");
+    else
+    {
+        OceanTileData data;
+        for (unsigned i = 0; i < tiles.Size(); ++i)
+        {
+            const unsigned begin = tiles[i].begin_;
+            const unsigned count = tiles[i].end_ - begin;
+            if (!store->ReadTile(i, data) || data.GetNumVertices() != count || store->GetTile(i).bounds_ != tiles[i].bounds_ ||
+                memcmp(data.restX_.Buffer(), vertices.restX_.Buffer() + begin, count * sizeof(float)) ||
+                memcmp(data.restY_.Buffer(), vertices.restY_.Buffer() + begin, count * sizeof(float)) ||
+                memcmp(data.restZ_.Buffer(), vertices.restZ_.Buffer() + begin, count * sizeof(float)) ||
+                memcmp(data.duplicates_.Buffer(), &vertices.duplicates_[begin], count * sizeof(unsigned)) ||
+                memcmp(data.shoreFactors_.Buffer(), &vertices.shoreFactors_[begin], count * sizeof(Vector2)))
+                AddFailure(result, ToString("TileStore: tile %u differs. ", i));
+        }
+
+        // A model whose tiles are split differently does not match
+        PODVector<OceanTile> otherTiles = tiles;
+        --otherTiles[0].end_;
+        --otherTiles[1].begin_;
+        if (store->MatchesTiles(otherTiles))
+            AddFailure(result, "TileStore: other tiles match the table. ");
+    }
+    store->Close();
+
+    // Cut off the last page, the last tile no longer lies within the file
+    {
+        File source(context_, fileName);
+        PODVector<unsigned char> bytes(source.GetSize());
+        source.Read(bytes.Buffer(), bytes.Size());
+        File truncated(context_, truncatedName, FILE_WRITE);
+        truncated.Write(bytes.Buffer(), bytes.Size() - GetOceanTilePageSize(tileSizes[3]));
+    }
+    if (store->Open(truncatedName))
+        AddFailure(result, "TileStore: a truncated file was opened. ");
+    store->Close();
+
+    fileSystem->Delete(fileName);
+    fileSystem->Delete(truncatedName);
+}
+
+void OceanTests::TestTileStoreUnload(Result& result)
+{
+    ++result.numTests_;
+
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    if (!fileSystem || !queue)
+    {
+        AddFailure(result, "TileStoreUnload: no file system or work queue. ");
+        return;
+    }
+
+    SharedPtr<Model> model = CreateGridModel(context_, UNLOAD_GRID_SIZE);
+    VertexBuffer* vertexBuffer = model->GetGeometry(0, 0)->GetVertexBuffer(0);
+    const unsigned dataSize = vertexBuffer->GetVertexCount() * vertexBuffer->GetVertexSize();
+
+    SharedPtr<Scene> scene(new Scene(context_));
+    scene->CreateComponent<Octree>();
+    Ocean* ocean = scene->CreateChild("Ocean")->CreateComponent<Ocean>();
+    ocean->SetModel(model);
+    queue->Complete(0);
+    AnimateOcean(scene, ocean, 2);
+
+    const String fileName = fileSystem->GetTemporaryDir() + "OceanTestsUnload.tiles";
+    if (!ocean->SaveTileStore(fileName) || !ocean->SetTileStore(fileName))
+    {
+        AddFailure(result, "TileStoreUnload: could not use the tile store " + fileName + ". ");
+        fileSystem->Delete(fileName);
+        return;
+    }
+    AnimateOcean(scene, ocean, 2);
+
+    // The mesh job is still pending, the ocean has no static data to animate from
+    PODVector<unsigned char> before(dataSize);
+    memcpy(before.Buffer(), vertexBuffer->GetShadowData(), dataSize);
+    ocean->SetTileStore(String::EMPTY);
+    AnimateOcean(scene, ocean, 4);
+    if (ocean->GetTileStore())
+        AddFailure(result, "TileStoreUnload: the tile store is still used. ");
+    if (memcmp(before.Buffer(), vertexBuffer->GetShadowData(), dataSize))
+        AddFailure(result, "TileStoreUnload: the ocean animated before the mesh data was prepared. ");
+
+    queue->Complete(0);
+    memcpy(before.Buffer(), vertexBuffer->GetShadowData(), dataSize);
+    AnimateOcean(scene, ocean, 4);
+    if (!memcmp(before.Buffer(), vertexBuffer->GetShadowData(), dataSize))
+        AddFailure(result, "TileStoreUnload: the ocean does not animate after the mesh data was prepared. ");
+
+    fileSystem->Delete(fileName);
+}
+
+#ifdef URHO3D_PHYSICS
+void OceanTests::TestBuoyancyBudget(Result& result)
+{
+    ++result.numTests_;
+
+    // Boats of 4 x 2 x 8 m in a grid 10 m apart, heavy enough to float half submerged
+    SharedPtr<Scene> scene(new Scene(context_));
+    scene->CreateComponent<Octree>();
+    scene->CreateComponent<PhysicsWorld>();
+    Ocean* ocean = scene->CreateChild("Ocean")->CreateComponent<Ocean>();
+    ocean->SetServerMode(true);
+    ocean->GetWaveManager()->SetWaveCount(16);
+
+    PODVector<OceanBuoyancy*> buoyancies;
+    for (unsigned i = 0; i < NUM_BUDGET_BODIES; ++i)
+    {
+        Node* node = scene->CreateChild("Boat");
+        node->SetPosition(Vector3((i % 25) * 10.f, 0.f, (i / 25) * 10.f));
+        node->CreateComponent<RigidBody>()->SetMass(32000.f);
+        node->CreateComponent<CollisionShape>()->SetBox(Vector3(4.f, 2.f, 8.f));
+        buoyancies.Push(node->CreateComponent<OceanBuoyancy>());
+    }
+
+    // The first second settles the bodies and grows the frame arena, the next two are measured. The physics world steps
+    // once per update at its default of 60 steps per second
+    OceanManager* oceanManager = scene->GetComponent<OceanManager>();
+    const float timeStep = 1.f / 60.f;
+    const unsigned numMeasuredSteps = 120;
+    float buoyancyTime = 0.f;
+    for (unsigned frame = 0; frame < 60 + numMeasuredSteps; ++frame)
+    {
+        scene->Update(timeStep);
+        if (frame >= 60)
+            buoyancyTime += oceanManager->GetBuoyancyTime();
+    }
+
+    unsigned numFloating = 0;
+    for (OceanBuoyancy* buoyancy : buoyancies)
+    {
+        if (buoyancy->GetSubmergedFraction() > 0.f && buoyancy->GetSubmergedFraction() < 1.f)
+            ++numFloating;
+    }
+    if (numFloating < NUM_BUDGET_BODIES)
+    {
+        AddFailure(result, ToString("Buoyancy: %u of %u bodies float. ", numFloating, NUM_BUDGET_BODIES));
+        return;
+    }
+
+    // The duration depends on the machine and its load, only the soak run holds it against the budget
+    URHO3D_LOGINFOF("Buoyancy of %u bodies takes %.3f ms per physics step", NUM_BUDGET_BODIES,
+        buoyancyTime / numMeasuredSteps);
+}
+#endif
+
+void OceanTests::AddFailure(Result& result, const String& failure)
+{
+    result.passed_ = false;
+    result.failures_ += failure;
+}
+
+}
@@ -0,0 +1,91 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+
+
+namespace Urho3D
+{
+
+/// The OceanTests compare the fast paths of the ocean with their references and check the replication of the waves.
+/// They run headless with -test on the command line, every failed check is reported with the measured value and its
+/// bound.
+class OceanTests : public Object
+{
+    URHO3D_OBJECT(OceanTests, Object);
+
+public:
+
+    /// Outcome of a run
+    struct Result
+    {
+        /// True if every check passed
+        bool passed_ = true;
+        /// Number of run tests
+        unsigned numTests_ = 0;
+        /// Description of every failed check
+        String failures_;
+    };
+
+    OceanTests(Context* context);
+    ~OceanTests();
+
+    /// Runs all tests
+    Result Run();
+    /// Returns a description of a run
+    static String GetReport(const Result& result);
+
+private:
+    /// Replicates a WaveSystem into another one through a snapshot and deltas, the waves must be identical bit for bit
+    /// after every delta and the deltas must stay small
+    void TestReplication(Result& result);
+
+    /// Sweeps phases up to 1e4 radians and compares the polynomial sine and cosine with the standard library. Larger
+    /// phases, up to the limit of float, must still give a point of the unit circle
+    void TestSinCos(Result& result);
+
+    /// Compares the positions and normals of CalculateGerstnerWavesAlongRow with the per-vertex kernel on a grid of rows
+    /// longer than OCEAN_ROW_RESEED, for the largest specialized and for the generic kernel
+    void TestGridRows(Result& result);
+
+    /// Writes a tile store of tiles of different sizes and reads every tile back, the data must be identical. A truncated
+    /// file and tiles that differ from the table must be rejected
+    void TestTileStore(Result& result);
+
+    /// Animates an ocean from a tile store and unloads the store. Until the mesh data has been prepared again the ocean
+    /// must keep its last shape, afterwards it must animate again
+    void TestTileStoreUnload(Result& result);
+
+#ifdef URHO3D_PHYSICS
+    /// Floats 500 bodies on an ocean with 16 waves, all of them must float. The duration of the buoyancy pass is logged,
+    /// the soak run checks it
+    void TestBuoyancyBudget(Result& result);
+#endif
+
+    /// Records a failed check
+    static void AddFailure(Result& result, const String& failure);
+};
+
+}
@@ -0,0 +1,535 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+#include "OceanTileStore.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace Urho3D
+{
+
+/// Version of the tile store file format, increase on every change of the layout
+static const unsigned OCEAN_TILE_STORE_VERSION = 1;
+/// Pages start at multiples of this many bytes, so that every tile maps to whole pages of the file
+static const unsigned OCEAN_TILE_PAGE_ALIGNMENT = 4096;
+
+/// Bytes of the header and of each entry of the tile table
+static const unsigned OCEAN_TILE_STORE_HEADER_SIZE = 20;
+static const unsigned OCEAN_TILE_STORE_ENTRY_SIZE = 36;
+/// Bytes of the arrays of one vertex in a page: rest x, y and z, the duplicate index and the shore factor
+static const unsigned OCEAN_TILE_VERTEX_SIZE = 3 * sizeof(float) + sizeof(unsigned) + sizeof(Vector2);
+
+/// Number of evicted tiles and of finished loads that are kept to be reused, so that streaming does not allocate
+static const unsigned OCEAN_TILE_STORE_FREE_OBJECTS = 8;
+
+/// A tile that is loaded on the WorkQueue
+struct OceanTileLoad : public RefCounted
+{
+    OceanTileStore* store_ = nullptr;
+    unsigned index_ = 0;
+    SharedPtr<OceanTileData> data_;
+    SharedPtr<WorkItem> workItem_;
+    bool succeeded_ = false;
+};
+
+static void LoadTileWork(const WorkItem* item, unsigned threadIndex)
+{
+    OceanTileLoad* load = reinterpret_cast<OceanTileLoad*>(item->aux_);
+    load->succeeded_ = load->store_->ReadTile(load->index_, *load->data_);
+}
+
+static unsigned AlignToPage(const unsigned offset)
+{
+    return (offset + OCEAN_TILE_PAGE_ALIGNMENT - 1) / OCEAN_TILE_PAGE_ALIGNMENT * OCEAN_TILE_PAGE_ALIGNMENT;
+}
+
+unsigned OceanTileData::GetMemoryUse() const
+{
+    return GetNumVertices() * 3 * sizeof(float) + duplicates_.Size() * sizeof(unsigned) +
+        shoreFactors_.Size() * sizeof(Vector2);
+}
+
+unsigned GetOceanTilePageSize(const unsigned numVertices)
+{
+    return AlignToPage(numVertices * OCEAN_TILE_VERTEX_SIZE);
+}
+
+bool SaveOceanTileStore(Context* context, const String& fileName, const PODVector<OceanTile>& tiles,
+    const OceanTileData& vertices)
+{
+    const unsigned numVertices = vertices.GetNumVertices();
+    const PODVector<Vector2>& shoreFactors = vertices.shoreFactors_;
+    if (!numVertices || vertices.duplicates_.Size() != numVertices ||
+        (!shoreFactors.Empty() && shoreFactors.Size() != numVertices))
+        return false;
+
+    File file(context, fileName, FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        URHO3D_LOGWARNING("Could not write ocean tile store " + fileName);
+        return false;
+    }
+
+    // The pages follow the tile table
+    unsigned pageOffset = AlignToPage(OCEAN_TILE_STORE_HEADER_SIZE + tiles.Size() * OCEAN_TILE_STORE_ENTRY_SIZE);
+
+    file.WriteFileID("OCTS");
+    file.WriteUInt(OCEAN_TILE_STORE_VERSION);
+    file.WriteUInt(numVertices);
+    file.WriteUInt(tiles.Size());
+    file.WriteUInt(shoreFactors.Empty() ? 0 : 1);
+    for (const auto& tile : tiles)
+    {
+        file.WriteUInt(tile.begin_);
+        file.WriteUInt(tile.end_);
+        file.WriteBoundingBox(tile.bounds_);
+        file.WriteUInt(pageOffset);
+        pageOffset += GetOceanTilePageSize(tile.end_ - tile.begin_);
+    }
+
+    // Each page holds the arrays of its tile one after another and is padded to the page alignment
+    PODVector<unsigned char> page;
+    for (const auto& tile : tiles)
+    {
+        const unsigned count = tile.end_ - tile.begin_;
+        page.Resize(GetOceanTilePageSize(count));
+        memset(page.Buffer(), 0, page.Size());
+
+        unsigned char* dest = page.Buffer();
+        memcpy(dest, vertices.restX_.Buffer() + tile.begin_, count * sizeof(float));
+        dest += count * sizeof(float);
+        memcpy(dest, vertices.restY_.Buffer() + tile.begin_, count * sizeof(float));
+        dest += count * sizeof(float);
+        memcpy(dest, vertices.restZ_.Buffer() + tile.begin_, count * sizeof(float));
+        dest += count * sizeof(float);
+        memcpy(dest, &vertices.duplicates_[tile.begin_], count * sizeof(unsigned));
+        dest += count * sizeof(unsigned);
+        if (!shoreFactors.Empty())
+            memcpy(dest, &shoreFactors[tile.begin_], count * sizeof(Vector2));
+
+        file.Seek(AlignToPage(file.GetPosition()));
+        if (file.Write(page.Buffer(), page.Size()) != page.Size())
+            return false;
+    }
+
+    return true;
+}
+
+OceanTileStore::OceanTileStore(Context* context) :
+    Object(context)
+{
+    SubscribeToEvent(E_WORKITEMCOMPLETED, URHO3D_HANDLER(OceanTileStore, HandleWorkItemCompleted));
+}
+
+OceanTileStore::~OceanTileStore()
+{
+    Close();
+}
+
+bool OceanTileStore::Open(const String& fileName)
+{
+    Close();
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    SharedPtr<File> file = cache ? cache->GetFile(fileName) : SharedPtr<File>();
+    if (!file || file->ReadFileID() != "OCTS" || file->ReadUInt() != OCEAN_TILE_STORE_VERSION)
+    {
+        URHO3D_LOGERROR("Could not open ocean tile store " + fileName);
+        return false;
+    }
+
+    // The table must fit into the file before anything is allocated for it
+    const unsigned long long fileSize = file->GetSize();
+    numVertices_ = file->ReadUInt();
+    const unsigned numTiles = file->ReadUInt();
+    hasShoreFactors_ = file->ReadUInt() != 0;
+    if (OCEAN_TILE_STORE_HEADER_SIZE + static_cast<unsigned long long>(numTiles) * OCEAN_TILE_STORE_ENTRY_SIZE > fileSize)
+    {
+        URHO3D_LOGERROR("Truncated tile table in ocean tile store " + fileName);
+        Close();
+        return false;
+    }
+
+    tiles_.Resize(numTiles);
+    pageOffsets_.Resize(numTiles);
+    for (unsigned i = 0; i < numTiles; ++i)
+    {
+        tiles_[i].begin_ = file->ReadUInt();
+        tiles_[i].end_ = file->ReadUInt();
+        tiles_[i].bounds_ = file->ReadBoundingBox();
+        pageOffsets_[i] = file->ReadUInt();
+    }
+
+    // The tiles must be sorted ranges of the vertices, and each page must lie aligned within the file
+    unsigned previousEnd = 0;
+    for (unsigned i = 0; i < numTiles; ++i)
+    {
+        const OceanTile& tile = tiles_[i];
+        const unsigned long long pageEnd = pageOffsets_[i] +
+            static_cast<unsigned long long>(tile.end_ - tile.begin_) * OCEAN_TILE_VERTEX_SIZE;
+        if (tile.begin_ < previousEnd || tile.end_ < tile.begin_ || tile.end_ > numVertices_ ||
+            pageOffsets_[i] % OCEAN_TILE_PAGE_ALIGNMENT || pageEnd > fileSize)
+        {
+            URHO3D_LOGERROR("Invalid tile " + String(i) + " in ocean tile store " + fileName);
+            Close();
+            return false;
+        }
+        previousEnd = tile.end_;
+    }
+
+    residentTiles_.Resize(numTiles);
+    lastUse_.Resize(numTiles);
+    unreadableTiles_.Resize(numTiles);
+    for (unsigned i = 0; i < numTiles; ++i)
+    {
+        lastUse_[i] = 0;
+        unreadableTiles_[i] = 0;
+    }
+
+    // Files inside packages have no name on disk and are read through the File instead
+    const String nativeName = GetNativePath(cache->GetResourceFileName(fileName));
+    if (!nativeName.Empty())
+    {
+#ifdef _WIN32
+        HANDLE fileHandle = CreateFileW(WString(nativeName).CString(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+        {
+            const DWORD size = GetFileSize(fileHandle, nullptr);
+            HANDLE mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(fileHandle);
+            void* view = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+            if (view)
+            {
+                mapping_ = static_cast<unsigned char*>(view);
+                mappingSize_ = size;
+                mappingHandle_ = mappingHandle;
+            }
+            else if (mappingHandle)
+                CloseHandle(mappingHandle);
+        }
+#else
+        const int fd = open(nativeName.CString(), O_RDONLY);
+        if (fd >= 0)
+        {
+            struct stat status;
+            if (fstat(fd, &status) == 0 && status.st_size > 0)
+            {
+                void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (view != MAP_FAILED)
+                {
+                    mapping_ = static_cast<unsigned char*>(view);
+                    mappingSize_ = (unsigned)status.st_size;
+                }
+            }
+            close(fd);
+        }
+#endif
+    }
+
+    if (!mapping_)
+        file_ = file;
+
+    return true;
+}
+
+void OceanTileStore::Close()
+{
+    // The worker threads write into the loads. Loads that have not started are removed from the queue, only the ones
+    // already running are waited for, not the other work items of their priority. Their completion events must no
+    // longer find them
+    Vector<SharedPtr<OceanTileLoad> > loads;
+    loads.Swap(loads_);
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    for (auto& load : loads)
+    {
+        if (!queue || queue->RemoveWorkItem(load->workItem_))
+            continue;
+        while (!load->workItem_->completed_)
+            Time::Sleep(0);
+    }
+
+    if (mapping_)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping_);
+        CloseHandle(static_cast<HANDLE>(mappingHandle_));
+#else
+        munmap(mapping_, mappingSize_);
+#endif
+        mapping_ = nullptr;
+        mappingSize_ = 0;
+        mappingHandle_ = nullptr;
+    }
+    file_.Reset();
+
+    tiles_.Clear();
+    pageOffsets_.Clear();
+    numVertices_ = 0;
+    residentTiles_.Clear();
+    lastUse_.Clear();
+    unreadableTiles_.Clear();
+    freeTiles_.Clear();
+    residentBytes_ = 0;
+    numResidentTiles_ = 0;
+}
+
+bool OceanTileStore::MatchesTiles(const PODVector<OceanTile>& tiles) const
+{
+    if (tiles.Size() != tiles_.Size())
+        return false;
+
+    for (unsigned i = 0; i < tiles.Size(); ++i)
+    {
+        if (tiles[i].begin_ != tiles_[i].begin_ || tiles[i].end_ != tiles_[i].end_)
+            return false;
+    }
+    return true;
+}
+
+OceanTileData* OceanTileStore::RequestTile(const unsigned index)
+{
+    if (index >= residentTiles_.Size())
+        return nullptr;
+
+    lastUse_[index] = frameNumber_;
+    if (!residentTiles_[index])
+        LoadTile(index);
+    return residentTiles_[index];
+}
+
+void OceanTileStore::Prefetch(const Vector3& position, const float distance)
+{
+    // Collect the tiles in reach by the distance to their bounds
+    prefetchTiles_.Clear();
+    for (unsigned i = 0; i < tiles_.Size(); ++i)
+    {
+        const float tileDistance = GetBoxDistance(tiles_[i].bounds_, position);
+        if (tileDistance <= distance)
+            prefetchTiles_.Push(MakePair(tileDistance, i));
+    }
+    Sort(prefetchTiles_.Begin(), prefetchTiles_.End());
+
+    // Nearest first, and no more than fit into the budget so that the prefetch does not evict what it just loaded
+    unsigned bytes = 0;
+    for (const auto& tile : prefetchTiles_)
+    {
+        const unsigned index = tile.second_;
+        bytes += GetOceanTilePageSize(tiles_[index].end_ - tiles_[index].begin_);
+        if (bytes > memoryBudget_)
+            break;
+
+        lastUse_[index] = frameNumber_;
+        if (!residentTiles_[index])
+            LoadTile(index);
+    }
+}
+
+void OceanTileStore::EndFrame()
+{
+    if (residentBytes_ > memoryBudget_)
+    {
+        // Evict the least recently used tiles, but none that was used in this frame
+        prefetchTiles_.Clear();
+        for (unsigned i = 0; i < residentTiles_.Size(); ++i)
+        {
+            if (residentTiles_[i] && lastUse_[i] != frameNumber_)
+                prefetchTiles_.Push(MakePair((float)lastUse_[i], i));
+        }
+        Sort(prefetchTiles_.Begin(), prefetchTiles_.End());
+
+        for (const auto& tile : prefetchTiles_)
+        {
+            if (residentBytes_ <= memoryBudget_)
+                break;
+
+            SharedPtr<OceanTileData>& data = residentTiles_[tile.second_];
+            residentBytes_ -= data->GetMemoryUse();
+            --numResidentTiles_;
+            if (freeTiles_.Size() < OCEAN_TILE_STORE_FREE_OBJECTS)
+                freeTiles_.Push(data);
+            data.Reset();
+        }
+    }
+
+    ++frameNumber_;
+}
+
+bool OceanTileStore::ReadTile(const unsigned index, OceanTileData& data)
+{
+    const unsigned count = tiles_[index].end_ - tiles_[index].begin_;
+    const unsigned offset = pageOffsets_[index];
+    const unsigned pageSize = GetOceanTilePageSize(count);
+    data.restX_.Resize(count);
+    data.restY_.Resize(count);
+    data.restZ_.Resize(count);
+    data.duplicates_.Resize(count);
+    data.shoreFactors_.Resize(hasShoreFactors_ ? count : 0);
+
+    if (mapping_)
+    {
+        if (offset + pageSize > mappingSize_)
+            return false;
+
+        // Reading the mapping pages the tile in on this thread. The pages are given back right after the copy, the
+        // decoded tile is what counts against the budget
+        const unsigned char* src = mapping_ + offset;
+        memcpy(data.restX_.Buffer(), src, count * sizeof(float));
+        src += count * sizeof(float);
+        memcpy(data.restY_.Buffer(), src, count * sizeof(float));
+        src += count * sizeof(float);
+        memcpy(data.restZ_.Buffer(), src, count * sizeof(float));
+        src += count * sizeof(float);
+        memcpy(data.duplicates_.Buffer(), src, count * sizeof(unsigned));
+        src += count * sizeof(unsigned);
+        if (hasShoreFactors_)
+            memcpy(data.shoreFactors_.Buffer(), src, count * sizeof(Vector2));
+#ifndef _WIN32
+        madvise(mapping_ + offset, pageSize, MADV_DONTNEED);
+#endif
+        return true;
+    }
+
+    MutexLock lock(fileMutex_);
+    if (!file_ || file_->Seek(offset) != offset)
+        return false;
+
+    bool success = file_->Read(data.restX_.Buffer(), count * sizeof(float)) == count * sizeof(float);
+    success &= file_->Read(data.restY_.Buffer(), count * sizeof(float)) == count * sizeof(float);
+    success &= file_->Read(data.restZ_.Buffer(), count * sizeof(float)) == count * sizeof(float);
+    success &= file_->Read(data.duplicates_.Buffer(), count * sizeof(unsigned)) == count * sizeof(unsigned);
+    if (hasShoreFactors_)
+        success &= file_->Read(data.shoreFactors_.Buffer(), count * sizeof(Vector2)) == count * sizeof(Vector2);
+    return success;
+}
+
+void OceanTileStore::LoadTile(const unsigned index)
+{
+    if (unreadableTiles_[index])
+        return;
+
+    for (const auto& load : loads_)
+    {
+        if (load->index_ == index)
+            return;
+    }
+
+    // Reuse the objects of finished loads and evicted tiles, all tiles have about the same size
+    SharedPtr<OceanTileLoad> load;
+    if (!freeLoads_.Empty())
+    {
+        load = freeLoads_.Back();
+        freeLoads_.Pop();
+    }
+    else
+        load = new OceanTileLoad();
+    if (!freeTiles_.Empty())
+    {
+        load->data_ = freeTiles_.Back();
+        freeTiles_.Pop();
+    }
+    else
+        load->data_ = new OceanTileData();
+    load->store_ = this;
+    load->index_ = index;
+    load->succeeded_ = false;
+
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    if (!queue)
+    {
+        // Without a WorkQueue the tile is read right away
+        load->succeeded_ = ReadTile(index, *load->data_);
+        CompleteLoad(*load);
+        return;
+    }
+
+    // Tile loads have the lowest priority, so the per-frame work that completes its own priority never waits for them
+    load->workItem_ = queue->GetFreeItem();
+    load->workItem_->workFunction_ = LoadTileWork;
+    load->workItem_->aux_ = load.Get();
+    load->workItem_->priority_ = 0;
+    load->workItem_->sendEvent_ = true;
+    loads_.Push(load);
+    queue->AddWorkItem(load->workItem_);
+}
+
+void OceanTileStore::HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData)
+{
+    using namespace WorkItemCompleted;
+
+    void* item = eventData[P_ITEM].GetVoidPtr();
+    for (unsigned i = 0; i < loads_.Size(); ++i)
+    {
+        if (loads_[i]->workItem_.Get() != item)
+            continue;
+
+        SharedPtr<OceanTileLoad> load = loads_[i];
+        loads_.Erase(i);
+        CompleteLoad(*load);
+        return;
+    }
+}
+
+void OceanTileStore::CompleteLoad(OceanTileLoad& load)
+{
+    if (load.succeeded_)
+    {
+        residentTiles_[load.index_] = load.data_;
+        residentBytes_ += load.data_->GetMemoryUse();
+        ++numResidentTiles_;
+    }
+    else
+    {
+        URHO3D_LOGERROR("Could not read ocean tile " + String(load.index_));
+        unreadableTiles_[load.index_] = 1;
+        if (freeTiles_.Size() < OCEAN_TILE_STORE_FREE_OBJECTS)
+            freeTiles_.Push(load.data_);
+    }
+
+    load.data_.Reset();
+    load.workItem_.Reset();
+    if (freeLoads_.Size() < OCEAN_TILE_STORE_FREE_OBJECTS)
+        freeLoads_.Push(SharedPtr<OceanTileLoad>(&load));
+}
+
+}
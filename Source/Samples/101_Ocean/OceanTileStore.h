@@ -0,0 +1,155 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Core/Object.h>
+
+#include "OceanAlgorithms.h"
+
+
+namespace Urho3D
+{
+
+class File;
+struct OceanTileLoad;
+
+/// Static data of the vertices of one ocean tile
+struct OceanTileData : public RefCounted
+{
+    /// Rest positions as a structure of arrays
+    AlignedFloatArray restX_;
+    AlignedFloatArray restY_;
+    AlignedFloatArray restZ_;
+    /// Index of the first vertex with the same position for each vertex, relative to the mesh
+    PODVector<unsigned> duplicates_;
+    /// Baked amplitude factor and phase lag of each vertex, empty without ground
+    PODVector<Vector2> shoreFactors_;
+
+    unsigned GetNumVertices() const { return restX_.Size(); }
+    /// Returns the bytes used by the arrays
+    unsigned GetMemoryUse() const;
+};
+
+/// Returns the size of the page that holds the static data of a tile in a tile store file
+unsigned GetOceanTilePageSize(const unsigned numVertices);
+/// Writes the static data of the vertices of a mesh into a paged tile store file, one page per tile
+bool SaveOceanTileStore(Context* context, const String& fileName, const PODVector<OceanTile>& tiles,
+    const OceanTileData& vertices);
+
+/// Pages the static tile data of a world-scale ocean in from a memory-mapped file. Only the tile table stays resident, the
+/// tiles are kept in an LRU cache with a memory budget and loaded asynchronously on the WorkQueue, so the memory of the
+/// rest positions, duplicates and shore factors follows the view distance. The model, its vertex buffer and the animated
+/// vertices of the Ocean keep the size of the mesh.
+class OceanTileStore : public Object
+{
+    URHO3D_OBJECT(OceanTileStore, Object);
+
+public:
+    OceanTileStore(Context* context);
+    ~OceanTileStore();
+
+    /// Open a tile store file. Maps the file into memory, or reads the pages through a File where that is not possible.
+    /// Fails if a tile is no sorted range of the vertices or its page does not lie within the file
+    bool Open(const String& fileName);
+    /// Close the file and release all tiles
+    void Close();
+    bool IsOpen() const { return mapping_ || file_; }
+
+    /// Set the budget of the resident tiles in bytes. Tiles used in the current frame are kept even above it
+    void SetMemoryBudget(const unsigned bytes) { memoryBudget_ = bytes; }
+    unsigned GetMemoryBudget() const { return memoryBudget_; }
+
+    /// Returns the number of vertices of the mesh the file was written from
+    unsigned GetNumVertices() const { return numVertices_; }
+    /// Returns the number of tiles in the file
+    unsigned GetNumTiles() const { return tiles_.Size(); }
+    /// Returns true if the tiles have the vertex ranges of the tiles in the file
+    bool MatchesTiles(const PODVector<OceanTile>& tiles) const;
+    /// Returns the vertex range and the rest bounds of a tile, which stay resident
+    const OceanTile& GetTile(const unsigned index) const { return tiles_[index]; }
+    /// Returns true if the file holds baked shore factors
+    bool HasShoreFactors() const { return hasShoreFactors_; }
+
+    /// Returns a resident tile and marks it as used in this frame, or starts loading it and returns null
+    OceanTileData* RequestTile(const unsigned index);
+    /// Starts loading the tiles whose rest bounds lie within distance of a position in the space of the mesh, nearest
+    /// first. Tiles that are already resident are marked as used
+    void Prefetch(const Vector3& position, const float distance);
+    /// Ends the frame. Evicts the least recently used tiles until the budget is met
+    void EndFrame();
+
+    /// Returns the number of resident tiles
+    unsigned GetNumResidentTiles() const { return numResidentTiles_; }
+    /// Returns the bytes used by the resident tiles
+    unsigned GetResidentBytes() const { return residentBytes_; }
+    /// Returns the number of tiles that are being loaded
+    unsigned GetNumPendingTiles() const { return loads_.Size(); }
+
+    /// Reads the page of a tile into data. Called by the worker threads
+    bool ReadTile(const unsigned index, OceanTileData& data);
+
+private:
+    /// Handle a completed tile load.
+    void HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData);
+    /// Queue the load of a tile
+    void LoadTile(const unsigned index);
+    /// Make a loaded tile resident
+    void CompleteLoad(OceanTileLoad& load);
+
+    /// Tile table, resident while the file is open
+    PODVector<OceanTile> tiles_;
+    /// File offset of the page of each tile
+    PODVector<unsigned> pageOffsets_;
+    /// Number of vertices of the mesh
+    unsigned numVertices_ = 0;
+    bool hasShoreFactors_ = false;
+    /// Resident tiles, null if not loaded
+    Vector<SharedPtr<OceanTileData> > residentTiles_;
+    /// Frame in which each tile was last used
+    PODVector<unsigned> lastUse_;
+    /// Tiles whose page could not be read, they are not requested again
+    PODVector<unsigned char> unreadableTiles_;
+    /// Loads in progress
+    Vector<SharedPtr<OceanTileLoad> > loads_;
+    /// Evicted tiles and finished loads that are reused by the next loads
+    Vector<SharedPtr<OceanTileData> > freeTiles_;
+    Vector<SharedPtr<OceanTileLoad> > freeLoads_;
+    /// Scratch list of the tiles to prefetch and their distances
+    PODVector<Pair<float, unsigned> > prefetchTiles_;
+
+    /// Mapped file, or the file and the lock of its position where mapping is not available
+    unsigned char* mapping_ = nullptr;
+    unsigned mappingSize_ = 0;
+    void* mappingHandle_ = nullptr;
+    SharedPtr<File> file_;
+    Mutex fileMutex_;
+
+    unsigned memoryBudget_ = 32 * 1024 * 1024;
+    unsigned residentBytes_ = 0;
+    unsigned numResidentTiles_ = 0;
+    unsigned frameNumber_ = 1;
+};
+
+}
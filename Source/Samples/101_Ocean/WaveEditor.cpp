@@ -293,7 +293,7 @@ void WaveEditor::HandleResetPressed(StringHash eventType, VariantMap& eventData)
     if (SharedPtr<WaveSystem> waveManager = waveManagerWeak_.Lock())
     {
         UpdateWaveSystem();
-        waveManager->Reset();
+        waveManager->CrossFade();
     }
 }
 
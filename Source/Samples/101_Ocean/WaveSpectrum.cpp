@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include "../Precompiled.h"
+
+#include "WaveSpectrum.h"
+
+
+namespace Urho3D
+{
+
+/// Ratio between the frequency with the most energy and the peak frequency of the spectrum
+static const float PEAK_RATIO = sqrtf(1.25f / 1.5f);
+
+/// Same linear congruential generator as WaveSystem, with the state passed in
+static float NextRandom(unsigned& seed, const float min, const float max)
+{
+    seed = seed * 214013 + 2531011;
+    const float value = ((seed >> 16) & 32767) / 32768.f;
+    return min + value * (max - min);
+}
+
+/// Relative amplitude of a Pierson-Moskowitz spectrum sampled at equal frequency steps, x is the ratio between the
+/// frequency and the peak frequency
+static float GetSpectrumAmplitude(const float x)
+{
+    return powf(x, -1.5f) * expf(-0.625f / (x * x));
+}
+
+WaveSpectrum::WaveSpectrum(Context* context) :
+    Object(context)
+{
+    Generate();
+}
+
+WaveSpectrum::~WaveSpectrum()
+{
+}
+
+void WaveSpectrum::Generate()
+{
+    bands_.Clear();
+    harmonics_.Clear();
+
+    unsigned seed = randomSeed_;
+    const float peakW = 2.0f * M_PI / length_;
+    const float peakAmplitude = GetSpectrumAmplitude(PEAK_RATIO);
+    const unsigned numWaves = numBands_ * numHarmonics_;
+    const Vector2 direction = direction_.Normalized();
+
+    // Spread the bands evenly over the angle, the energy falls off towards its borders
+    PODVector<float> bandAngles(numBands_);
+    PODVector<float> bandWeights(numBands_);
+    float totalWeight = 0.f;
+    for (unsigned i = 0; i < numBands_; ++i)
+    {
+        const float step = angle_ / numBands_;
+        bandAngles[i] = (i + 0.5f) * step - 0.5f * angle_ + NextRandom(seed, -0.25f * step, 0.25f * step);
+        const float spread = angle_ > 0.f ? Cos(bandAngles[i] * 180.f / angle_) : 1.f;
+        bandWeights[i] = spread * spread;
+        totalWeight += bandWeights[i];
+    }
+
+    for (unsigned i = 0; i < numBands_; ++i)
+    {
+        Band band;
+        band.d_.x_ = direction.x_ * Cos(bandAngles[i]) - direction.y_ * Sin(bandAngles[i]);
+        band.d_.y_ = direction.x_ * Sin(bandAngles[i]) + direction.y_ * Cos(bandAngles[i]);
+
+        // The longest wave of a band is about twice the peak length, its harmonics reach far into the short waves.
+        // The jitter keeps the bands from repeating in sync
+        band.w_ = 0.5f * peakW * NextRandom(seed, 0.8f, 1.2f);
+        band.begin_ = harmonics_.Size();
+        band.end_ = band.begin_ + numHarmonics_;
+        bands_.Push(band);
+
+        // The bands share the energy, so that the height of the sea does not depend on their count
+        const float bandAmplitude = amplitude_ * sqrtf(bandWeights[i] / totalWeight);
+        for (unsigned n = 1; n <= numHarmonics_; ++n)
+        {
+            const float w = n * band.w_;
+
+            Harmonic harmonic;
+            harmonic.a_ = bandAmplitude * GetSpectrumAmplitude(w / peakW) / peakAmplitude;
+            harmonic.qa_ = steepness_ / (w * numWaves);
+            harmonic.wa_ = w * harmonic.a_;
+            harmonic.qwa_ = steepness_ / numWaves;
+            // Deep water dispersion
+            harmonic.omega_ = sqrtf(9.81f * w);
+            harmonic.phase_ = NextRandom(seed, 0.f, 2.0f * M_PI);
+            harmonics_.Push(harmonic);
+        }
+    }
+}
+
+void WaveSpectrum::AdvancePhases(const float time, PODVector<float>& phases) const
+{
+    if (phases.Size() != harmonics_.Size())
+    {
+        phases.Resize(harmonics_.Size());
+        for (unsigned i = 0; i < harmonics_.Size(); ++i)
+            phases[i] = harmonics_[i].phase_;
+    }
+
+    for (unsigned i = 0; i < harmonics_.Size(); ++i)
+    {
+        phases[i] = fmodf(phases[i] + harmonics_[i].omega_ * time, 2.0f * M_PI);
+        if (phases[i] < 0.f)
+            phases[i] += 2.0f * M_PI;
+    }
+}
+
+void WaveSpectrum::GetPhases(const PODVector<float>& phases, const float offset, PODVector<Vector2>& result) const
+{
+    result.Resize(Min(phases.Size(), harmonics_.Size()));
+    for (unsigned i = 0; i < result.Size(); ++i)
+    {
+        const float phase = phases[i] + harmonics_[i].omega_ * offset;
+        result[i] = Vector2(cos(phase), sin(phase));
+    }
+}
+
+}
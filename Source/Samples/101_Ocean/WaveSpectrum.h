@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2008-2016 the Urho3D project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector2.h>
+
+
+namespace Urho3D
+{
+
+/// The WaveSpectrum samples many Gerstner waves from a directional spectrum. The waves are grouped into direction
+/// bands, within a band all wavelengths are whole fractions of the longest one, so that a vertex only needs one
+/// sin and cos per band and derives the others by recurrence.
+class WaveSpectrum : public Object
+{
+    URHO3D_OBJECT(WaveSpectrum, Object);
+
+public:
+
+    /// Waves that share a direction. Harmonic n has n times the frequency of the band
+    struct Band
+    {
+        /// The movement direction of all waves of the band
+        Vector2 d_;
+        /// Frequency of the longest wave, 2 pi divided by its length
+        float w_;
+        /// Range of the harmonics of the band
+        unsigned begin_;
+        unsigned end_;
+    };
+
+    /// A wave of a band, with the products the kernel needs precomputed
+    struct Harmonic
+    {
+        /// The amplitude
+        float a_;
+        /// Horizontal displacement, steepness times amplitude
+        float qa_;
+        /// Slope, frequency times amplitude
+        float wa_;
+        /// Steepness times frequency times amplitude
+        float qwa_;
+        /// Angular speed of the phase in radians per second
+        float omega_;
+        /// Phase at time 0
+        float phase_;
+    };
+
+    WaveSpectrum(Context* context);
+    ~WaveSpectrum();
+
+    /// Setter and Getter. Generate needs to be called after a change
+    void SetBandCount(const unsigned value) { numBands_ = Max(value, 1u); }
+    unsigned GetBandCount() const { return numBands_; }
+
+    void SetHarmonicCount(const unsigned value) { numHarmonics_ = Max(value, 1u); }
+    unsigned GetHarmonicCount() const { return numHarmonics_; }
+
+    void SetSteepness(const float value) { steepness_ = value; }
+    float GetSteepness() const { return steepness_; }
+
+    void SetLength(const float value) { length_ = value; }
+    float GetLength() const { return length_; }
+
+    void SetAmplitude(const float value) { amplitude_ = value; }
+    float GetAmplitude() const { return amplitude_; }
+
+    void SetDirection(const Vector2 value) { direction_ = value; }
+    const Vector2 GetDirection() const { return direction_; }
+
+    void SetAngle(const float value) { angle_ = value; }
+    float GetAngle() const { return angle_; }
+
+    void SetRandomSeed(const unsigned seed) { randomSeed_ = seed; }
+    unsigned GetRandomSeed() const { return randomSeed_; }
+
+    /// Samples the waves from the spectrum. The same settings and seed always give the same waves
+    void Generate();
+
+    /// Returns the direction bands
+    const PODVector<Band>& GetBands() const { return bands_; }
+    /// Returns the waves of all bands
+    const PODVector<Harmonic>& GetHarmonics() const { return harmonics_; }
+    /// Returns the number of waves
+    unsigned GetWaveCount() const { return harmonics_.Size(); }
+    /// Advances the phase of each wave by time seconds and wraps it into [0, 2 pi). The phases are reset to the
+    /// phases at time 0 if their count does not match the waves
+    void AdvancePhases(const float time, PODVector<float>& phases) const;
+    /// Evaluates the cosine and sine of the phase of each wave offset seconds after the advanced phases
+    void GetPhases(const PODVector<float>& phases, const float offset, PODVector<Vector2>& result) const;
+
+private:
+
+    /// Number of direction bands
+    unsigned numBands_ = 16;
+    /// Number of waves per band
+    unsigned numHarmonics_ = 8;
+
+    /// Overall steepness between 0.f and 1.f, shared by all waves
+    float steepness_ = 0.3f;
+    /// Length of the waves with the most energy
+    float length_ = 3.5f;
+    /// Amplitude of the waves with the most energy, the sum of all bands
+    float amplitude_ = 0.04f;
+    /// Main direction of the waves
+    Vector2 direction_{ 1.0f, 0.0f };
+    /// The bands are spread over this angle around the main direction
+    float angle_ = 90.f;
+    /// Seed of the generator
+    unsigned randomSeed_ = 1;
+
+    PODVector<Band> bands_;
+    PODVector<Harmonic> harmonics_;
+};
+
+}
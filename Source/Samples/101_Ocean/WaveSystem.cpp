@@ -21,7 +21,10 @@
 //
 
 #include "../Precompiled.h"
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/IO/Deserializer.h>
 #include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/Serializer.h>
 #include <Urho3D/Core/Profiler.h>
 
 #include "WaveSystem.h"
@@ -30,6 +33,190 @@
 namespace Urho3D
 {
 
+/// Version of the snapshot format, increase on every change of the layout
+static const unsigned char SNAPSHOT_VERSION = 3;
+static const unsigned char SNAPSHOT_FULL = 0;
+static const unsigned char SNAPSHOT_DELTA = 1;
+
+/// Encodes a positive float into 16 bits with 5 bits exponent and 11 bits mantissa (about 0.05% precision)
+static unsigned short EncodeUFloat16(const float value)
+{
+    if (!(value > 0.f))
+        return 0;
+
+    int exponent;
+    const float mantissa = frexpf(value, &exponent);
+    int biasedExponent = exponent + 15;
+    if (biasedExponent <= 0)
+        return 0;
+
+    unsigned bits = static_cast<unsigned>(RoundToInt((mantissa * 2.f - 1.f) * 2048.f));
+    if (bits == 2048)
+    {
+        bits = 0;
+        ++biasedExponent;
+    }
+    if (biasedExponent > 31)
+        return 0xffff;
+
+    return static_cast<unsigned short>((biasedExponent << 11) | bits);
+}
+
+/// Decodes a value written by EncodeUFloat16. The result is exact and therefore identical on every machine
+static float DecodeUFloat16(const unsigned short value)
+{
+    if (!value)
+        return 0.f;
+
+    const int biasedExponent = value >> 11;
+    const unsigned bits = value & 2047u;
+    return ldexpf(0.5f + bits / 4096.f, biasedExponent - 15);
+}
+
+static unsigned char EncodeUnitFloat(const float value)
+{
+    return static_cast<unsigned char>(RoundToInt(Clamp(value, 0.f, 1.f) * 255.f));
+}
+
+static float DecodeUnitFloat(const unsigned char value)
+{
+    return value / 255.f;
+}
+
+static short EncodeSignedUnitFloat(const float value)
+{
+    return static_cast<short>(RoundToInt(Clamp(value, -1.f, 1.f) * 32767.f));
+}
+
+static float DecodeSignedUnitFloat(const short value)
+{
+    return value / 32767.f;
+}
+
+/// A Wave in the form in which it is replicated
+struct QuantizedWave
+{
+    unsigned id_;
+    unsigned char steepness_;
+    unsigned short speed_;
+    unsigned short length_;
+    unsigned short amplitude_;
+    short directionX_;
+    short directionY_;
+    float startTime_;
+    unsigned short fadeDuration_;
+    unsigned short lifetime_;
+};
+
+static QuantizedWave EncodeWave(const WaveSystem::Wave& wave)
+{
+    QuantizedWave quantized;
+    quantized.id_ = wave.id_;
+    quantized.steepness_ = EncodeUnitFloat(wave.targetSteepness_);
+    quantized.speed_ = EncodeUFloat16(wave.s_);
+    quantized.length_ = EncodeUFloat16(wave.l_);
+    quantized.amplitude_ = EncodeUFloat16(wave.targetAmplitude_);
+    quantized.directionX_ = EncodeSignedUnitFloat(wave.d_.x_);
+    quantized.directionY_ = EncodeSignedUnitFloat(wave.d_.y_);
+    quantized.startTime_ = wave.startTime_;
+    quantized.fadeDuration_ = EncodeUFloat16(wave.fadeInEnd_ - wave.startTime_);
+    quantized.lifetime_ = EncodeUFloat16(wave.fadeOutStart_ - wave.startTime_);
+    return quantized;
+}
+
+static WaveSystem::Wave DecodeWave(const QuantizedWave& quantized)
+{
+    WaveSystem::Wave wave(DecodeUnitFloat(quantized.steepness_), DecodeUFloat16(quantized.speed_),
+        DecodeUFloat16(quantized.length_), DecodeUFloat16(quantized.amplitude_),
+        Vector2(DecodeSignedUnitFloat(quantized.directionX_), DecodeSignedUnitFloat(quantized.directionY_)));
+    wave.id_ = quantized.id_;
+    const float fadeDuration = DecodeUFloat16(quantized.fadeDuration_);
+    wave.startTime_ = quantized.startTime_;
+    wave.fadeInEnd_ = wave.startTime_ + fadeDuration;
+    wave.fadeOutStart_ = wave.startTime_ + DecodeUFloat16(quantized.lifetime_);
+    wave.fadeOutEnd_ = wave.fadeOutStart_ + fadeDuration;
+    return wave;
+}
+
+/// Writes a Wave in its quantized form, 21 bytes when the id fits into two bytes
+static void WriteWave(Serializer& dest, const WaveSystem::Wave& wave)
+{
+    const QuantizedWave quantized = EncodeWave(wave);
+    dest.WriteVLE(quantized.id_);
+    dest.WriteUByte(quantized.steepness_);
+    dest.WriteUShort(quantized.speed_);
+    dest.WriteUShort(quantized.length_);
+    dest.WriteUShort(quantized.amplitude_);
+    dest.WriteShort(quantized.directionX_);
+    dest.WriteShort(quantized.directionY_);
+    dest.WriteFloat(quantized.startTime_);
+    dest.WriteUShort(quantized.fadeDuration_);
+    dest.WriteUShort(quantized.lifetime_);
+}
+
+/// Reads a Wave written by WriteWave
+static WaveSystem::Wave ReadWave(Deserializer& source)
+{
+    QuantizedWave quantized;
+    quantized.id_ = source.ReadVLE();
+    quantized.steepness_ = source.ReadUByte();
+    quantized.speed_ = source.ReadUShort();
+    quantized.length_ = source.ReadUShort();
+    quantized.amplitude_ = source.ReadUShort();
+    quantized.directionX_ = source.ReadShort();
+    quantized.directionY_ = source.ReadShort();
+    quantized.startTime_ = source.ReadFloat();
+    quantized.fadeDuration_ = source.ReadUShort();
+    quantized.lifetime_ = source.ReadUShort();
+    return DecodeWave(quantized);
+}
+
+/// Writes the fade-out of a retired Wave. The times are not quantized, they replace what ReadWave derived
+static void WriteRetiredWave(Serializer& dest, const WaveSystem::Wave& wave)
+{
+    dest.WriteVLE(wave.id_);
+    dest.WriteFloat(wave.fadeOutStart_);
+    dest.WriteFloat(wave.fadeOutEnd_);
+}
+
+/// Reads a record written by WriteRetiredWave and applies it to the Wave with its id, unknown ids are ignored
+static void ReadRetiredWave(Deserializer& source, PODVector<WaveSystem::Wave>& waves)
+{
+    const unsigned id = source.ReadVLE();
+    const float fadeOutStart = source.ReadFloat();
+    const float fadeOutEnd = source.ReadFloat();
+    for (auto& wave : waves)
+    {
+        if (wave.id_ == id)
+        {
+            wave.retired_ = true;
+            wave.fadeOutStart_ = fadeOutStart;
+            wave.fadeOutEnd_ = fadeOutEnd;
+            break;
+        }
+    }
+}
+
+/// Rounds the wave vector to a whole number of crests along both axes of the tile
+static void SnapToTileSize(const Vector2& tileSize, float& length, Vector2& direction)
+{
+    int crestsX = RoundToInt(direction.x_ * tileSize.x_ / length);
+    int crestsY = RoundToInt(direction.y_ * tileSize.y_ / length);
+
+    // Keep at least one crest along the dominant axis, a wave longer than the tile cannot repeat
+    if (crestsX == 0 && crestsY == 0)
+    {
+        if (Abs(direction.x_) >= Abs(direction.y_))
+            crestsX = direction.x_ < 0.f ? -1 : 1;
+        else
+            crestsY = direction.y_ < 0.f ? -1 : 1;
+    }
+
+    const Vector2 waveVector(crestsX / tileSize.x_, crestsY / tileSize.y_);
+    length = 1.f / waveVector.Length();
+    direction = waveVector * length;
+}
+
 WaveSystem::WaveSystem(Context* context) :
     Object(context)
 {
@@ -39,78 +226,369 @@ WaveSystem::~WaveSystem()
 {
 }
 
+float WaveSystem::Wave::GetFade(const float t) const
+{
+    if (!IsAlive(t))
+        return 0.f;
+
+    // Linear ramp up during fade-in
+    float fade = 1.f;
+    if (t < fadeInEnd_)
+        fade = (t - startTime_) / (fadeInEnd_ - startTime_);
+
+    // Linear ramp down during fade-out
+    if (t > fadeOutStart_)
+        fade = Min(fade, (fadeOutEnd_ - t) / (fadeOutEnd_ - fadeOutStart_));
+
+    return Clamp(fade, 0.f, 1.f);
+}
+
+void WaveSystem::Wave::Evaluate(const float t)
+{
+    const float fade = GetFade(t);
+    a_ = targetAmplitude_ * fade;
+    q_ = targetSteepness_ * fade;
+
+    // Derived from replicated values only, a phase summed over the frames would differ between replicas
+    phase_ = fmodf(GetAngularSpeed() * (t - startTime_), 2.0f * M_PI);
+    if (phase_ < 0.f)
+        phase_ += 2.0f * M_PI;
+}
+
 void WaveSystem::Update(const float time)
 {
     URHO3D_PROFILE(WaveSystem);
 
-    // Handle waves that are currently fading in
-    auto itWaveFadeIn = fadeInWaves_.begin();
-    while (itWaveFadeIn != fadeInWaves_.end())
+    const float previousTime = time_;
+
+    // Compensated sum, a plain float sum of frame time steps drifts by seconds per hour
+    const float step = time - timeCompensation_;
+    const float sum = time_ + step;
+    timeCompensation_ = (sum - time_) - step;
+    time_ = sum;
+
+    ReplaceWaves(previousTime, time_, waves_, generator_, &removedWaves_);
+
+    // Evaluate the envelopes at the current time
+    for (auto& wave : waves_)
     {
-        itWaveFadeIn->wave_->a_ += itWaveFadeIn->fadeAmplitude_ * time;
-        itWaveFadeIn->wave_->q_ += itWaveFadeIn->fadeSteepness_ * time;
-        if (itWaveFadeIn->wave_->a_ >= itWaveFadeIn->targetAmplitude_)
-            itWaveFadeIn = fadeInWaves_.erase(itWaveFadeIn);
-        else
-            ++itWaveFadeIn;
+        wave.Evaluate(time_);
     }
 
-    // Handle fade outs
-    auto itWaveFadeOut = fadeOutWaves_.begin();
-    while (itWaveFadeOut != fadeOutWaves_.end())
+    // Remove emitters that have ended
+    for (unsigned j = emitters_.Size(); j-- > 0;)
     {
-        itWaveFadeOut->wave_->a_ -= itWaveFadeOut->fadeAmplitude_ * time;
-        itWaveFadeOut->wave_->q_ -= itWaveFadeOut->fadeSteepness_ * time;
-        if (itWaveFadeOut->wave_->a_ <= itWaveFadeOut->targetAmplitude_)
+        if (emitters_[j].endTime_ <= time_)
         {
-            // Erase from active waves
-            EraseActiveWave(itWaveFadeOut->wave_);
-            itWaveFadeOut = fadeOutWaves_.erase(itWaveFadeOut);
+            emitters_.Erase(j);
+            emitterGridDirty_ = true;
         }
-        else
+    }
+
+    // Only the replicated epoch moves the time of a replica
+    if (time_ >= WAVE_TIME_WRAP && !replicated_)
+    {
+        ShiftTime(-WAVE_TIME_WRAP);
+        ++epoch_;
+    }
+}
+
+void WaveSystem::ShiftTime(const float offset)
+{
+    time_ += offset;
+    generator_.nextCreationTime_ += offset;
+    for (auto& wave : waves_)
+    {
+        wave.startTime_ += offset;
+        wave.fadeInEnd_ += offset;
+        wave.fadeOutStart_ += offset;
+        wave.fadeOutEnd_ += offset;
+    }
+    for (auto& emitter : emitters_)
+    {
+        emitter.startTime_ += offset;
+        emitter.endTime_ += offset;
+    }
+}
+
+void WaveSystem::Reset()
+{
+    while (!waves_.Empty())
+        RemoveWave(waves_.Size() - 1);
+}
+
+void WaveSystem::CrossFade()
+{
+    // Retire the waves at the pace at which their successors are created, so the sea keeps its height
+    const float interval = GetChurnInterval(maxCreationRate_);
+    float fadeOutStart = Max(time_, generator_.nextCreationTime_);
+    for (auto& wave : waves_)
+    {
+        // Waves that already fade out are replaced as usual
+        if (wave.retired_ || wave.fadeOutStart_ <= fadeOutStart)
+            continue;
+
+        const float fadeDuration = wave.fadeOutEnd_ - wave.fadeOutStart_;
+        wave.retired_ = true;
+        wave.fadeOutStart_ = fadeOutStart;
+        wave.fadeOutEnd_ = fadeOutStart + fadeDuration;
+        fadeOutStart += interval;
+        if (!replicated_)
+            retiredWaves_.Push(wave.id_);
+    }
+}
+
+void WaveSystem::ReplaceWaves(const float previousTime, const float time, PODVector<Wave>& waves, Generator& generator,
+    PODVector<unsigned>* removedIds) const
+{
+    // Replace waves whose envelope has ended. The successor starts exactly when its predecessor ended, or when the
+    // creation rate allows, so the sequence of waves does not depend on the frame rate
+    unsigned i = 0;
+    while (i < waves.Size())
+    {
+        const float endTime = waves[i].fadeOutEnd_;
+        if (endTime > time)
+        {
+            ++i;
+            continue;
+        }
+
+        // Waves that were created after the last delta are never sent, so their removal is not sent either
+        const bool retired = waves[i].retired_;
+        if (removedIds && waves[i].id_ < deltaBaseId_ && !replicated_)
+            removedIds->Push(waves[i].id_);
+        waves.Erase(i);
+
+        // The successor is appended, so a replica that applies removals before creations keeps the same order
+        if (!retired && GetNumActiveWaves(waves) < numWaves_ && !replicated_)
+            ScheduleWave(endTime, time, waves, generator);
+    }
+
+    // Fade-In waves if there are less than wanted, e.g. after the count changed, a cross-fade or a delayed successor.
+    // They start at the time before this step or when the creation rate allows
+    while (GetNumActiveWaves(waves) < numWaves_ && !replicated_ && ScheduleWave(previousTime, time, waves, generator))
+    {
+    }
+}
+
+bool WaveSystem::ScheduleWave(const float startTime, const float time, PODVector<Wave>& waves, Generator& generator) const
+{
+    const float start = Max(startTime, generator.nextCreationTime_);
+    if (start > time)
+        return false;
+
+    generator.nextCreationTime_ = start + GetChurnInterval(maxCreationRate_);
+    waves.Push(CreateWave(start, waves, generator));
+    return true;
+}
+
+float WaveSystem::GetChurnInterval(const float rate) const
+{
+    // The shortest lifetime is half the lifetime, faster churn than that would let the wave count drop
+    const float requiredRate = lifetime_ > 0.f ? Max(numWaves_, 0) / (lifetime_ * 0.5f) : 0.f;
+    return 1.f / Max(rate, requiredRate);
+}
+
+unsigned WaveSystem::GetNumRetiredWaves() const
+{
+    return waves_.Size() - GetNumActiveWaves(waves_);
+}
+
+int WaveSystem::GetNumActiveWaves(const PODVector<Wave>& waves)
+{
+    int count = 0;
+    for (const auto& wave : waves)
+    {
+        if (!wave.retired_)
+            ++count;
+    }
+    return count;
+}
+
+void WaveSystem::PredictWaves(const float offset, PODVector<Wave>& waves) const
+{
+    // Step a copy of the waves and of the generator from one expiration or delayed creation to the next, so that the
+    // waves are replaced in the same order and with the same random values as by the updates until then
+    waves = waves_;
+    Generator generator = generator_;
+    const float endTime = time_ + offset;
+    float time = time_;
+    while (time < endTime)
+    {
+        float next = endTime;
+        for (const auto& wave : waves)
         {
-            ++itWaveFadeOut;
+            if (wave.fadeOutEnd_ > time)
+                next = Min(next, wave.fadeOutEnd_);
         }
+        if (generator.nextCreationTime_ > time && GetNumActiveWaves(waves) < numWaves_ && !replicated_)
+            next = Min(next, generator.nextCreationTime_);
+
+        ReplaceWaves(time, next, waves, generator, nullptr);
+        time = next;
+    }
+
+    // The past is not replayed, a negative offset only keeps the waves that were alive then
+    for (unsigned i = waves.Size(); i-- > 0;)
+    {
+        if (waves[i].IsAlive(endTime))
+            waves[i].Evaluate(endTime);
+        else
+            waves.Erase(i);
+    }
+}
+
+float WaveSystem::GetPredictionHorizon() const
+{
+    if (!replicated_)
+        return M_INFINITY;
+    // A wave has ended and its successor has not been received yet
+    if (GetNumActiveWaves(waves_) < numWaves_)
+        return 0.f;
+
+    float horizon = M_INFINITY;
+    for (const auto& wave : waves_)
+    {
+        if (wave.fadeOutEnd_ > time_)
+            horizon = Min(horizon, wave.fadeOutEnd_ - time_);
     }
+    return horizon;
+}
 
-    // Handle active waves
-    for (auto& activeWave : activeWaves_)
+unsigned WaveSystem::GetMemoryUse() const
+{
+    unsigned bytes = waves_.Capacity() * sizeof(Wave) + (removedWaves_.Capacity() + retiredWaves_.Capacity()) * sizeof(unsigned) +
+        emitters_.Capacity() * sizeof(Emitter);
+    return bytes + emitterGrid_.Capacity() * sizeof(Pair<unsigned, unsigned>);
+}
+
+unsigned WaveSystem::AddEmitter(const EmitterType type, const Vector2& position, const float radius, const float amplitude,
+    const float length, const float lifetime)
+{
+    Emitter emitter;
+    emitter.type_ = type;
+    emitter.position_ = position;
+    emitter.radius_ = radius;
+    emitter.amplitude_ = amplitude;
+    emitter.length_ = length;
+    // Ripples spread with the speed of a deep water wave of their length
+    emitter.speed_ = Sqrt(9.81f * length / (2.0f * M_PI));
+    emitter.startTime_ = time_;
+    emitter.endTime_ = time_ + lifetime;
+    emitter.id_ = nextEmitterId_++;
+    emitters_.Push(emitter);
+    emitterGridDirty_ = true;
+    return emitter.id_;
+}
+
+bool WaveSystem::SetEmitterPosition(const unsigned id, const Vector2& position, const Vector2& direction)
+{
+    for (auto& emitter : emitters_)
     {
-        activeWave.lifeTime_ -= time;
-        if (activeWave.lifeTime_ <= 0.f && !activeWave.isFadingOut)
+        if (emitter.id_ == id)
         {
-            activeWave.isFadingOut = true;
-            FadeOutWave(activeWave.wave_.get());
+            emitter.position_ = position;
+            emitter.direction_ = direction.Normalized();
+            emitterGridDirty_ = true;
+            return true;
         }
     }
+    return false;
+}
 
-    // Fade-In waves if there are less than wanted
-    for (size_t i = activeWaves_.size(); i < numWaves_; ++i)
+void WaveSystem::RemoveEmitter(const unsigned id)
+{
+    for (unsigned i = 0; i < emitters_.Size(); ++i)
     {
-        FadeInWave();
+        if (emitters_[i].id_ == id)
+        {
+            emitters_.Erase(i);
+            emitterGridDirty_ = true;
+            return;
+        }
     }
 }
 
-void WaveSystem::Reset()
+/// Returns the index of the first entry of a cell in the sorted emitter grid, or the index where it would be
+static unsigned FindEmitterCell(const PODVector<Pair<unsigned, unsigned> >& grid, const unsigned key)
 {
-    fadeInWaves_.clear();
-    fadeOutWaves_.clear();
-    activeWaves_.clear();
+    unsigned first = 0;
+    unsigned count = grid.Size();
+    while (count > 0)
+    {
+        const unsigned half = count / 2;
+        if (grid[first + half].first_ < key)
+        {
+            first += half + 1;
+            count -= half + 1;
+        }
+        else
+            count = half;
+    }
+    return first;
 }
 
-const PODVector<WaveSystem::Wave*> WaveSystem::GetWaves() const
+unsigned WaveSystem::QueryEmitters(const Vector2& min, const Vector2& max, unsigned* result) const
 {
-    PODVector<WaveSystem::Wave*> waves;
+    if (emitters_.Empty())
+        return 0;
+
+    if (emitterGridDirty_)
+        UpdateEmitterGrid();
 
-    for (auto wave : activeWaves_)
+    const IntVector2 minCell = GetEmitterCell(min);
+    const IntVector2 maxCell = GetEmitterCell(max);
+    unsigned numResults = 0;
+    for (int y = minCell.y_; y <= maxCell.y_; ++y)
     {
-        waves.Push(wave.wave_.get());
+        for (int x = minCell.x_; x <= maxCell.x_; ++x)
+        {
+            const unsigned key = ((unsigned)x & 0xffff) | ((unsigned)y << 16);
+            for (unsigned i = FindEmitterCell(emitterGrid_, key); i < emitterGrid_.Size() && emitterGrid_[i].first_ == key; ++i)
+            {
+                const unsigned index = emitterGrid_[i].second_;
+                const Emitter& emitter = emitters_[index];
+
+                // An emitter that covers several cells is only reported by the first of them inside the rectangle
+                const IntVector2 emitterCell = GetEmitterCell(emitter.position_ - Vector2(emitter.radius_, emitter.radius_));
+                if (Max(emitterCell.x_, minCell.x_) != x || Max(emitterCell.y_, minCell.y_) != y)
+                    continue;
+
+                // Distance from the position to the closest point of the rectangle
+                const Vector2 closest(Clamp(emitter.position_.x_, min.x_, max.x_), Clamp(emitter.position_.y_, min.y_, max.y_));
+                if ((emitter.position_ - closest).LengthSquared() < emitter.radius_ * emitter.radius_)
+                    result[numResults++] = index;
+            }
+        }
     }
+    return numResults;
+}
 
-    return waves;
+IntVector2 WaveSystem::GetEmitterCell(const Vector2& position) const
+{
+    return IntVector2(FloorToInt(position.x_ / emitterCellSize_), FloorToInt(position.y_ / emitterCellSize_));
 }
 
-WaveSystem::Wave* WaveSystem::CreateWave()
+void WaveSystem::UpdateEmitterGrid() const
+{
+    emitterGrid_.Clear();
+    for (unsigned i = 0; i < emitters_.Size(); ++i)
+    {
+        const Emitter& emitter = emitters_[i];
+        const Vector2 extent(emitter.radius_, emitter.radius_);
+        const IntVector2 minCell = GetEmitterCell(emitter.position_ - extent);
+        const IntVector2 maxCell = GetEmitterCell(emitter.position_ + extent);
+        for (int y = minCell.y_; y <= maxCell.y_; ++y)
+        {
+            for (int x = minCell.x_; x <= maxCell.x_; ++x)
+                emitterGrid_.Push(MakePair(((unsigned)x & 0xffff) | ((unsigned)y << 16), i));
+        }
+    }
+    Sort(emitterGrid_.Begin(), emitterGrid_.End());
+    emitterGridDirty_ = false;
+}
+
+WaveSystem::Wave WaveSystem::CreateWave(const float startTime, const PODVector<Wave>& waves, Generator& generator) const
 {
     // Create a new Wave by deriving properties from the source values
 
@@ -118,64 +596,274 @@ WaveSystem::Wave* WaveSystem::CreateWave()
     const float amplitudeLengthRatio = amplitude_ / length_;
 
     // The new length of the wave is between half and double of the source values
-    const float length = Random(0.5f * length_, 2.0f * length_);
-
-    // Calculate the new amplitude by preserving the ratio
-    const float amplitude = length * amplitudeLengthRatio;
+    float length = NextRandom(generator.seed_, 0.5f * length_, 2.0f * length_);
 
     // The new direction varies within the given angle
-    const float angle = Random(-0.5f * angle_, 0.5f * angle_);
+    const float angle = NextRandom(generator.seed_, -0.5f * angle_, 0.5f * angle_);
     Vector2 direction;
     direction.x_ = direction_.x_ * Cos(angle) - direction_.y_ * Sin(angle);
     direction.y_ = direction_.x_ * Sin(angle) + direction_.y_ * Cos(angle);
 
+    if (tileSize_.x_ > 0.f && tileSize_.y_ > 0.f)
+        SnapToTileSize(tileSize_, length, direction);
+
+    // Calculate the new amplitude by preserving the ratio
+    const float amplitude = length * amplitudeLengthRatio;
+
     // If enabled the new speed is randomized
     float speed = speed_;
     if (speedVariationEnabled_)
-        float speed = Random(0.7f * speed_, 3.0f * speed_);
+        speed = NextRandom(generator.seed_, 0.7f * speed_, 3.0f * speed_);
+
+    Wave wave(steepness_, speed, length, amplitude, direction);
+    wave.id_ = generator.nextWaveId_++;
 
-    return new Wave(steepness_, speed, length, amplitude, direction);
+    // The lifetime includes the fade-in, the fade-out follows after it
+    const float lifetime = NextRandom(generator.seed_, lifetime_ * 0.5f, lifetime_ * 2.0f);
+    const float fadeDuration = fadingEnabled_ ? fadeDuration_ : 0.f;
+    wave.startTime_ = startTime;
+    wave.fadeInEnd_ = startTime + fadeDuration;
+    wave.fadeOutStart_ = startTime + lifetime;
+    wave.fadeOutEnd_ = wave.fadeOutStart_ + fadeDuration;
+
+    // Keep the ends of the waves apart, so that waves created together do not expire together
+    const float spacing = GetChurnInterval(maxExpirationRate_);
+    for (unsigned pass = 0; pass < waves.Size(); ++pass)
+    {
+        bool moved = false;
+        for (const auto& other : waves)
+        {
+            if (!other.retired_ && Abs(other.fadeOutEnd_ - wave.fadeOutEnd_) < spacing)
+            {
+                const float shift = other.fadeOutEnd_ + spacing - wave.fadeOutEnd_;
+                wave.fadeOutStart_ += shift;
+                wave.fadeOutEnd_ += shift;
+                moved = true;
+            }
+        }
+        if (!moved)
+            break;
+    }
+
+    // Keep only the precision that is replicated, so that remote WaveSystems end up with identical waves
+    return DecodeWave(EncodeWave(wave));
 }
 
-void WaveSystem::FadeInWave()
+void WaveSystem::RemoveWave(const unsigned index)
 {
-    // Creates a new wave to fade-in
-    Wave* newWave = CreateWave();
+    // Waves that were created after the last delta are never sent, so their removal is not sent either
+    if (waves_[index].id_ < deltaBaseId_ && !replicated_)
+        removedWaves_.Push(waves_[index].id_);
 
-    // All waves reside in the active waves vector
-    activeWaves_.push_back(Active{ Random(lifetime_ * 0.5f, lifetime_ * 2.0f), false, std::shared_ptr<Wave>(newWave) });
+    waves_.Erase(index);
+}
 
-    URHO3D_LOGINFOF("Fade-In wave. Currently active %i", activeWaves_.size());
+float WaveSystem::NextRandom(unsigned& seed, const float min, const float max)
+{
+    // Same linear congruential generator as Urho3D's Rand(), but with a state owned by the WaveSystem
+    seed = seed * 214013 + 2531011;
+    const float value = ((seed >> 16) & 32767) / 32768.f;
+    return min + value * (max - min);
+}
+
+void WaveSystem::WriteSnapshot(Serializer& dest) const
+{
+    dest.WriteUByte(SNAPSHOT_VERSION);
+    dest.WriteUByte(SNAPSHOT_FULL);
+    dest.WriteFloat(time_);
+    dest.WriteVLE(epoch_);
+
+    // Generator state and source values, so a replica may later take over wave creation
+    dest.WriteUInt(generator_.seed_);
+    dest.WriteVLE(generator_.nextWaveId_);
+    dest.WriteVLE(static_cast<unsigned>(Max(numWaves_, 0)));
+    dest.WriteFloat(lifetime_);
+    dest.WriteFloat(steepness_);
+    dest.WriteFloat(speed_);
+    dest.WriteFloat(length_);
+    dest.WriteFloat(amplitude_);
+    dest.WriteVector2(direction_);
+    dest.WriteFloat(angle_);
+    dest.WriteUByte(static_cast<unsigned char>((fadingEnabled_ ? 1 : 0) | (speedVariationEnabled_ ? 2 : 0)));
 
-    // If fading is enabled add the wave to the fade-in vector
-    if (fadingEnabled_)
+    dest.WriteVLE(waves_.Size());
+    for (const auto& wave : waves_)
+        WriteWave(dest, wave);
+
+    // The fade-outs that CrossFade moved follow the waves
+    dest.WriteVLE(GetNumRetiredWaves());
+    for (const auto& wave : waves_)
     {
-        fadeInWaves_.push_back(Fade{ newWave->a_, newWave->a_ / fadeDuration_, newWave->q_, newWave->q_ / fadeDuration_, newWave });
-        newWave->a_ = 0.f;
-        newWave->q_ = 0.f;
+        if (wave.retired_)
+            WriteRetiredWave(dest, wave);
+    }
+}
+
+bool WaveSystem::ReadSnapshot(Deserializer& source)
+{
+    if (source.ReadUByte() != SNAPSHOT_VERSION || source.ReadUByte() != SNAPSHOT_FULL)
+    {
+        URHO3D_LOGERROR("Unsupported wave snapshot version");
+        return false;
+    }
+
+    time_ = source.ReadFloat();
+    timeCompensation_ = 0.f;
+    epoch_ = source.ReadVLE();
+    generator_.seed_ = source.ReadUInt();
+    generator_.nextWaveId_ = source.ReadVLE();
+    numWaves_ = static_cast<int>(source.ReadVLE());
+    lifetime_ = source.ReadFloat();
+    steepness_ = source.ReadFloat();
+    speed_ = source.ReadFloat();
+    length_ = source.ReadFloat();
+    amplitude_ = source.ReadFloat();
+    direction_ = source.ReadVector2();
+    angle_ = source.ReadFloat();
+    const unsigned char flags = source.ReadUByte();
+    fadingEnabled_ = (flags & 1) != 0;
+    speedVariationEnabled_ = (flags & 2) != 0;
+
+    deltaBaseId_ = generator_.nextWaveId_;
+    removedWaves_.Clear();
+    retiredWaves_.Clear();
+    generator_.nextCreationTime_ = time_;
+
+    const unsigned numWaves = source.ReadVLE();
+    waves_.Clear();
+    for (unsigned i = 0; i < numWaves; ++i)
+    {
+        if (source.IsEof())
+        {
+            URHO3D_LOGERROR("Truncated wave snapshot");
+            return false;
+        }
+        waves_.Push(ReadWave(source));
+    }
+
+    const unsigned numRetired = source.ReadVLE();
+    for (unsigned i = 0; i < numRetired; ++i)
+    {
+        if (source.IsEof())
+        {
+            URHO3D_LOGERROR("Truncated wave snapshot");
+            return false;
+        }
+        ReadRetiredWave(source, waves_);
     }
+
+    // The phase is not replicated, it is derived from the age of the Wave
+    for (auto& wave : waves_)
+        wave.Evaluate(time_);
+
+    return true;
 }
 
-void WaveSystem::FadeOutWave(Wave* wave)
+void WaveSystem::WriteDelta(Serializer& dest)
 {
-    fadeOutWaves_.push_back(Fade{ 0.0f, wave->a_ / fadeDuration_, 0.0f, wave->q_ / fadeDuration_, wave });
+    dest.WriteUByte(SNAPSHOT_VERSION);
+    dest.WriteUByte(SNAPSHOT_DELTA);
+    dest.WriteFloat(time_);
+    dest.WriteVLE(epoch_);
+
+    dest.WriteVLE(removedWaves_.Size());
+    for (unsigned id : removedWaves_)
+        dest.WriteVLE(id);
 
-    if (!fadingEnabled_)
+    // Created waves are appended in order of creation, waves created and removed since the last delta are skipped
+    unsigned numCreated = 0;
+    for (const auto& wave : waves_)
     {
-        wave->a_ = 0.f;
+        if (wave.id_ >= deltaBaseId_)
+            ++numCreated;
     }
+    dest.WriteVLE(numCreated);
+    for (const auto& wave : waves_)
+    {
+        if (wave.id_ >= deltaBaseId_)
+            WriteWave(dest, wave);
+    }
+
+    // Retirements follow the creations, so they also apply to waves created since the last delta. Waves that ended since
+    // were sent as removed
+    unsigned numRetired = 0;
+    for (const auto& wave : waves_)
+    {
+        if (wave.retired_ && retiredWaves_.Contains(wave.id_))
+            ++numRetired;
+    }
+    dest.WriteVLE(numRetired);
+    for (const auto& wave : waves_)
+    {
+        if (wave.retired_ && retiredWaves_.Contains(wave.id_))
+            WriteRetiredWave(dest, wave);
+    }
+
+    removedWaves_.Clear();
+    retiredWaves_.Clear();
+    deltaBaseId_ = generator_.nextWaveId_;
 }
 
-void WaveSystem::EraseActiveWave(Wave* wave)
+bool WaveSystem::ReadDelta(Deserializer& source)
 {
-    for (auto itWave = activeWaves_.begin(); itWave != activeWaves_.end(); ++itWave)
+    if (source.ReadUByte() != SNAPSHOT_VERSION || source.ReadUByte() != SNAPSHOT_DELTA)
     {
-        if (itWave->wave_.get() == wave)
+        URHO3D_LOGERROR("Unsupported wave delta version");
+        return false;
+    }
+
+    const float time = source.ReadFloat();
+    const unsigned epoch = source.ReadVLE();
+
+    // Move the known waves and emitters into the epoch of the source before taking over its time
+    if (epoch != epoch_)
+    {
+        ShiftTime((static_cast<float>(epoch_) - static_cast<float>(epoch)) * WAVE_TIME_WRAP);
+        epoch_ = epoch;
+    }
+    time_ = time;
+    timeCompensation_ = 0.f;
+
+    // The replica may already have removed expired waves on its own, unknown ids are ignored
+    const unsigned numRemoved = source.ReadVLE();
+    for (unsigned i = 0; i < numRemoved; ++i)
+    {
+        const unsigned id = source.ReadVLE();
+        for (unsigned j = 0; j < waves_.Size(); ++j)
         {
-            activeWaves_.erase(itWave);
-            return;
+            if (waves_[j].id_ == id)
+            {
+                waves_.Erase(j);
+                break;
+            }
+        }
+    }
+
+    const unsigned numCreated = source.ReadVLE();
+    for (unsigned i = 0; i < numCreated; ++i)
+    {
+        if (source.IsEof())
+        {
+            URHO3D_LOGERROR("Truncated wave delta");
+            return false;
         }
+        // A late joining replica already knows the waves that were contained in its snapshot
+        Wave wave = ReadWave(source);
+        if (wave.id_ < generator_.nextWaveId_)
+            continue;
+
+        waves_.Push(wave);
+        generator_.nextWaveId_ = wave.id_ + 1;
     }
+
+    const unsigned numRetired = source.ReadVLE();
+    for (unsigned i = 0; i < numRetired; ++i)
+        ReadRetiredWave(source, waves_);
+
+    for (auto& wave : waves_)
+        wave.Evaluate(time_);
+
+    return true;
 }
 
 }
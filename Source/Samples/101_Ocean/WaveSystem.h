@@ -24,15 +24,21 @@
 
 #include <Urho3D/Core/Object.h>
 #include <Urho3D/Math/Vector2.h>
+#include <Urho3D/Container/Pair.h>
 #include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/MathDefs.h>
 
-#include <tuple>
-#include <memory>
-#include <vector>
 
 namespace Urho3D
 {
 
+class Deserializer;
+class Serializer;
+
+/// The time of a WaveSystem is wrapped back after this many seconds, so that a float keeps it precise however long
+/// the WaveSystem runs
+static const float WAVE_TIME_WRAP = 1024.f;
+
 /// The WaveSystem is responsible to create and manage waves used by the Ocean component.
 class WaveSystem : public Object
 {
@@ -44,9 +50,18 @@ public:
     struct Wave
     {
         Wave(const float q, const float s, const float l, const float a, const Vector2 d) :
-            q_{ q }, s_{ s }, l_{ l }, a_{ a }, d_{ d }
+            q_{ q }, s_{ s }, l_{ l }, a_{ a }, d_{ d }, targetSteepness_{ q }, targetAmplitude_{ a }
         {}
 
+        /// Returns the fade factor between 0.f and 1.f of the Wave at the absolute time t
+        float GetFade(const float t) const;
+        /// Returns true if the Wave contributes to the surface at the absolute time t
+        bool IsAlive(const float t) const { return t >= startTime_ && t < fadeOutEnd_; }
+        /// Sets amplitude, steepness and phase to their values at the absolute time t
+        void Evaluate(const float t);
+        /// Returns the speed of the phase in radians per second
+        float GetAngularSpeed() const { return l_ != 0.f ? s_ * 2.0f * M_PI / l_ : 0.f; }
+
         /// Steepness between 0.f and 1.f
         float q_;
         /// The speed of a Wave
@@ -57,6 +72,57 @@ public:
         float a_;
         /// The movement direction of the Wave
         Vector2 d_;
+        /// Phase in radians at the last evaluated time, kept in [0, 2 pi). It follows from the age of the Wave, which
+        /// unlike the absolute time stays short however long the WaveSystem runs, and is the same on every replica
+        float phase_ = 0.f;
+
+        /// Unique id of the Wave within its WaveSystem, used to replicate removals
+        unsigned id_ = 0;
+        /// Set when a cross-fade faded the Wave out early, it no longer counts towards the wave count
+        bool retired_ = false;
+
+        /// Steepness and amplitude when the Wave is fully faded in
+        float targetSteepness_;
+        float targetAmplitude_;
+
+        /// Absolute times of the Wave envelope. The Wave fades in between startTime_ and fadeInEnd_,
+        /// stays at its target values until fadeOutStart_ and fades out until fadeOutEnd_
+        float startTime_ = 0.f;
+        float fadeInEnd_ = 0.f;
+        float fadeOutStart_ = M_INFINITY;
+        float fadeOutEnd_ = M_INFINITY;
+    };
+
+    /// Shape of the waves of a local emitter
+    enum EmitterType
+    {
+        /// Circular ring that spreads from the position
+        EMITTER_RIPPLE = 0,
+        /// Kelvin wedge that trails behind the position along the direction
+        EMITTER_WAKE
+    };
+
+    /// A local source of waves with a bounded radius and lifetime, e.g. a splash or the wake of a boat
+    struct Emitter
+    {
+        EmitterType type_ = EMITTER_RIPPLE;
+        /// Position in the plane of the waves
+        Vector2 position_{ 0.0f, 0.0f };
+        /// Movement direction of the source of a wake
+        Vector2 direction_{ 1.0f, 0.0f };
+        /// Nothing outside of this distance to the position is affected
+        float radius_ = 1.0f;
+        /// Amplitude at the position, it falls off towards the radius and over the lifetime
+        float amplitude_ = 0.05f;
+        /// The length between the crests
+        float length_ = 0.5f;
+        /// The speed at which a ripple spreads
+        float speed_ = 1.0f;
+        /// Absolute times of the start and the end
+        float startTime_ = 0.f;
+        float endTime_ = M_INFINITY;
+        /// Unique id of the Emitter within its WaveSystem
+        unsigned id_ = 0;
     };
 
     WaveSystem(Context* context);
@@ -93,39 +159,127 @@ public:
     void EnableSpeedVariation(const bool value) { speedVariationEnabled_ = value; }
     bool SpeedVariationEnabled() const { return speedVariationEnabled_; }
 
+    /// Set the size of a repeated ocean tile. New waves get a whole number of crests along both axes of the tile,
+    /// so that tiles of this size join without seams. A zero size disables the snapping
+    void SetTileSize(const Vector2 value) { tileSize_ = value; }
+    const Vector2 GetTileSize() const { return tileSize_; }
+
+    /// Set the greatest number of waves created per second, further creations are delayed to later frames. The rate
+    /// is raised if it could not keep up with the wave count and the lifetime
+    void SetMaxCreationRate(const float value) { maxCreationRate_ = Max(value, M_EPSILON); }
+    float GetMaxCreationRate() const { return maxCreationRate_; }
+    /// Set the greatest number of waves that end per second. The lifetimes of new waves are stretched to keep their
+    /// ends apart, the rate is raised like the creation rate
+    void SetMaxExpirationRate(const float value) { maxExpirationRate_ = Max(value, M_EPSILON); }
+    float GetMaxExpirationRate() const { return maxExpirationRate_; }
+
+    /// Advances the time and the phases of the WaveSystem, replaces expired waves and evaluates the active ones
     void Update(const float time);
 
+    /// Removes all waves at once
     void Reset();
-
-    /// Returns the active waves
-    const PODVector<Wave*> GetWaves() const;
+    /// Fades the current waves out one after another while waves created from the current source values fade in
+    void CrossFade();
+
+    /// Returns the absolute time of the WaveSystem within the current epoch
+    float GetTime() const { return time_; }
+    /// Returns the number of times the time has been wrapped back by WAVE_TIME_WRAP seconds
+    unsigned GetEpoch() const { return epoch_; }
+    /// Returns the time since the start of the WaveSystem, including the wrapped epochs
+    double GetTotalTime() const { return epoch_ * static_cast<double>(WAVE_TIME_WRAP) + time_; }
+    /// Marks the frame in which an OceanManager updated the WaveSystem. A WaveSystem shared by the oceans of several
+    /// scenes is updated only by the first of them in each frame
+    void SetUpdateFrame(const unsigned frameNumber) { updateFrame_ = frameNumber; }
+    unsigned GetUpdateFrame() const { return updateFrame_; }
+
+    /// Sets the seed of the generator used to create new waves
+    void SetRandomSeed(const unsigned seed) { generator_.seed_ = seed; }
+    unsigned GetRandomSeed() const { return generator_.seed_; }
+
+    /// A replicated WaveSystem never creates waves itself, they are received through snapshots
+    void SetReplicated(const bool value) { replicated_ = value; }
+    bool IsReplicated() const { return replicated_; }
+
+    /// Writes the complete state into a versioned binary snapshot, e.g. for a late joining client
+    void WriteSnapshot(Serializer& dest) const;
+    /// Replaces the complete state with a snapshot written by WriteSnapshot. Returns false if the data is invalid
+    bool ReadSnapshot(Deserializer& source);
+    /// Writes the waves created, removed and retired by CrossFade since the last delta
+    void WriteDelta(Serializer& dest);
+    /// Applies a delta written by WriteDelta. Returns false if the data is invalid
+    bool ReadDelta(Deserializer& source);
+
+    /// Adds a local emitter that starts at the current time and ends after lifetime seconds. Returns its id
+    unsigned AddEmitter(const EmitterType type, const Vector2& position, const float radius, const float amplitude,
+        const float length, const float lifetime);
+    /// Moves an emitter, e.g. the wake along with its boat. Returns false if the emitter has ended
+    bool SetEmitterPosition(const unsigned id, const Vector2& position, const Vector2& direction);
+    /// Removes an emitter before the end of its lifetime
+    void RemoveEmitter(const unsigned id);
+    /// Returns all emitters that have not ended yet
+    const PODVector<Emitter>& GetEmitters() const { return emitters_; }
+    /// Set the cell size of the grid that sorts the emitters by position
+    void SetEmitterCellSize(const float value) { emitterCellSize_ = Max(value, M_EPSILON); emitterGridDirty_ = true; }
+    float GetEmitterCellSize() const { return emitterCellSize_; }
+    /// Writes the indices of the emitters whose radius overlaps the rectangle between min and max to result and returns
+    /// their number. result must hold as many indices as there are emitters
+    unsigned QueryEmitters(const Vector2& min, const Vector2& max, unsigned* result) const;
+    /// Sorts changed emitters into their cells, after which QueryEmitters may be called from several threads
+    void PrepareEmitterQueries() const { if (emitterGridDirty_) UpdateEmitterGrid(); }
+
+    /// Returns the active waves evaluated at the current time
+    const PODVector<Wave>& GetWaves() const { return waves_; }
+    /// Returns the waves offset seconds after the current time, evaluated and with their phases, without stepping. The
+    /// waves that end until then are replaced by the same successors that Update will create, so the result is exact as
+    /// long as the source values do not change in between. A replica does not know the successors before they are received
+    void PredictWaves(const float offset, PODVector<Wave>& waves) const;
+    /// Returns how many seconds ahead PredictWaves is exact. A replica does not know a successor before it is received,
+    /// so its horizon ends with the first wave that ends
+    float GetPredictionHorizon() const;
+
+    /// Returns the number of bytes reserved by the containers of the WaveSystem
+    unsigned GetMemoryUse() const;
 
 private:
 
-    /// Stores data needed for fading in and out a Wave
-    struct Fade
+    /// State that decides which waves are created next. PredictWaves advances a copy of it
+    struct Generator
     {
-        float targetAmplitude_;
-        float fadeAmplitude_;
-        float targetSteepness_;
-        float fadeSteepness_;
-        Wave* wave_;
+        /// State of the random number generator
+        unsigned seed_ = 1;
+        /// Id of the next created Wave
+        unsigned nextWaveId_ = 1;
+        /// Earliest time of the next creation
+        float nextCreationTime_ = 0.f;
     };
 
-    /// Stores data for an active Wave
-    struct Active
-    {
-        float lifeTime_;
-        bool isFadingOut;
-        std::shared_ptr<Wave> wave_;
-    };
+    /// Creates a new Wave based on the source values, starting at the absolute time startTime. Its end is kept apart
+    /// from the ends of waves
+    Wave CreateWave(const float startTime, const PODVector<Wave>& waves, Generator& generator) const;
+    /// Appends a new Wave to waves that starts at startTime, or later if the creation rate requires it. Returns false if
+    /// it would start after time
+    bool ScheduleWave(const float startTime, const float time, PODVector<Wave>& waves, Generator& generator) const;
+    /// Removes the waves that have ended at time, creates their successors and fills up the wave count. previousTime is
+    /// the time before the step. The ids of removed waves that the next delta has to send are added to removedIds, if set
+    void ReplaceWaves(const float previousTime, const float time, PODVector<Wave>& waves, Generator& generator,
+        PODVector<unsigned>* removedIds) const;
+    /// Returns the seconds between two creations or expirations at rate, raised to keep up with the wave count
+    float GetChurnInterval(const float rate) const;
+    /// Returns the number of waves that are not retired
+    static int GetNumActiveWaves(const PODVector<Wave>& waves);
+    /// Returns the number of retired waves
+    unsigned GetNumRetiredWaves() const;
+    /// Removes the Wave at index and remembers it for the next delta
+    void RemoveWave(const unsigned index);
+    /// Returns the grid cell that contains the position
+    IntVector2 GetEmitterCell(const Vector2& position) const;
+    /// Sorts the emitters into the cells of the grid they overlap
+    void UpdateEmitterGrid() const;
+    /// Moves the time and all times of the waves and emitters by offset seconds
+    void ShiftTime(const float offset);
+    /// Returns a random value between min and max and advances the state of the generator
+    static float NextRandom(unsigned& seed, const float min, const float max);
 
-    /// Creates a new Wave based on the source values
-    Wave* CreateWave();
-    void FadeInWave();
-    void FadeOutWave(Wave* wave);
-    void EraseActiveWave(Wave* wave);
-    
     /// Max number of active waves
     int numWaves_ = 6;
 
@@ -137,7 +291,7 @@ private:
     float speed_ = 0.7f;
     float length_ = 3.5f;
     float amplitude_ = 0.04f;
-    Vector2& direction_ = Vector2{1.0f, 0.0f};
+    Vector2 direction_{ 1.0f, 0.0f };
     float angle_ = 90.f;
 
     bool fadingEnabled_ = true;
@@ -148,9 +302,46 @@ private:
     /// If enabled, the speed of waves varies
     bool speedVariationEnabled_ = false;
 
-    std::vector<Active> activeWaves_;
-    std::vector<Fade> fadeInWaves_;
-    std::vector<Fade> fadeOutWaves_;
+    /// Limits of the churn in waves per second
+    float maxCreationRate_ = 2.0f;
+    float maxExpirationRate_ = 2.0f;
+
+    /// Size of a repeated ocean tile the waves are snapped to, zero if disabled
+    Vector2 tileSize_{ 0.0f, 0.0f };
+
+    /// Absolute time in seconds within the epoch
+    float time_ = 0.f;
+    /// Part of the time steps lost in the rounding of time_
+    float timeCompensation_ = 0.f;
+    /// Number of wraps of the time
+    unsigned epoch_ = 0;
+    /// Frame of the last update by an OceanManager
+    unsigned updateFrame_ = 0;
+
+    /// All waves, including those fading in and out
+    PODVector<Wave> waves_;
+
+    /// State of the creation of new waves
+    Generator generator_;
+    /// Waves with this id or greater have been created since the last delta
+    unsigned deltaBaseId_ = 1;
+    /// Ids of the waves removed since the last delta
+    PODVector<unsigned> removedWaves_;
+    /// Ids of the waves retired by CrossFade since the last delta
+    PODVector<unsigned> retiredWaves_;
+    /// If enabled, waves are only received through snapshots
+    bool replicated_ = false;
+
+    /// Local emitters, they are not part of snapshots
+    PODVector<Emitter> emitters_;
+    /// Id of the next added Emitter
+    unsigned nextEmitterId_ = 1;
+    /// Size of a cell of the emitter grid
+    float emitterCellSize_ = 8.0f;
+    /// Key of each cell that an emitter overlaps and the index of the emitter, sorted by both. Rebuilt when the
+    /// emitters changed, in place, so moving emitters do not allocate
+    mutable PODVector<Pair<unsigned, unsigned> > emitterGrid_;
+    mutable bool emitterGridDirty_ = false;
 };
 
 }